@@ -0,0 +1,379 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2016 Matthew Bedder (bedder@gmail.com)
+//
+// This code has been released under the MIT license. See the LICENSE file in
+// the project root for more information
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// A self-contained set of benchmarks for tracking regressions, with results as
+// CSV or JSON so runs can be compared. It covers:
+//    addTask      - throughput of empty tasks, for each SchedulingMode
+//    latency      - submit-to-start latency percentiles, for tasks added one at
+//                   a time to an idle pool, and for tasks added in bursts
+//    barrier      - the cost of waitUntilComplete and TaskGroup::wait, with
+//                   and without tasks to wait for
+//    contention   - addTask throughput with 1 to maxProducers threads adding
+//                   tasks at once
+//    optional     - construct, copy and move of Copyable, NonCopyable, their
+//                   inline counterparts and std::optional over a large vector
+//
+// Each measurement is repeated and the median reported. The other benchmarks
+// in this directory go into more detail on particular features.
+//
+// Usage: BenchmarkSuite [--format=csv|json] [--threads=N] [--producers=N]
+//                       [--repetitions=N] [--quick] [--filter=name]
+////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Optional.h"
+#include "ThreadPool.h"
+
+using namespace helper;
+using Clock = std::chrono::steady_clock;
+
+struct Settings {
+  std::string format       = "csv";
+  size_t      nThreads     = std::max(1u, std::thread::hardware_concurrency());
+  size_t      maxProducers = std::max(4u, std::thread::hardware_concurrency());
+  size_t      repetitions  = 5;
+  size_t      scale        = 1;   // Divides the amount of work, 10 with --quick
+  std::string filter;
+};
+
+struct Result {
+  std::string benchmark;
+  std::string variant;
+  std::string metric;
+  double      value;
+  std::string unit;
+};
+
+// Keeps a value alive, so the compiler can't optimise away what computed it
+template <typename T>
+void keep(const T& value) {
+  asm volatile("" : : "r"(&value) : "memory");
+}
+
+double seconds(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Runs `measure` (which returns one sample) the given number of times
+template <typename F>
+double median(size_t repetitions, F measure) {
+  std::vector<double> samples;
+  for (size_t i = 0; i < repetitions; i++)
+    samples.push_back(measure());
+  std::sort(samples.begin(), samples.end());
+  return samples[samples.size() / 2];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void benchAddTask(const Settings& settings, std::vector<Result>& results) {
+  const size_t nTasks = 1000000 / settings.scale;
+  const std::pair<const char*, SchedulingMode> modes[] = {
+    { "SharedQueue",  SchedulingMode::SharedQueue },
+    { "WorkStealing", SchedulingMode::WorkStealing },
+  };
+  for (const auto& mode : modes) {
+    ThreadPoolOptions options;
+    options.nThreads   = settings.nThreads;
+    options.scheduling = mode.second;
+    ThreadPool pool(options, &std::cerr);
+
+    // From outside the pool, and (as a parallel algorithm or a task splitting
+    // its work would) from inside a task
+    const double outside = median(settings.repetitions, [&]() {
+      auto start = Clock::now();
+      for (size_t i = 0; i < nTasks; i++)
+        pool.addTask([]() {});
+      pool.waitUntilComplete();
+      return seconds(start);
+    });
+    const double inside = median(settings.repetitions, [&]() {
+      auto start = Clock::now();
+      pool.addTask([&pool, nTasks]() {
+        for (size_t i = 0; i < nTasks; i++)
+          pool.addTask([]() {});
+      });
+      pool.waitUntilComplete();
+      return seconds(start);
+    });
+    results.push_back({ "addTask", std::string(mode.first) + "/external", "throughput",
+                        nTasks / outside, "tasks/s" });
+    results.push_back({ "addTask", std::string(mode.first) + "/from task", "throughput",
+                        nTasks / inside, "tasks/s" });
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void benchLatency(const Settings& settings, std::vector<Result>& results) {
+  const size_t nTasks = 20000 / settings.scale;
+  ThreadPool pool(settings.nThreads, &std::cerr);
+  std::vector<Clock::time_point> submitted(nTasks), started(nTasks);
+
+  const std::pair<const char*, size_t> patterns[] = {
+    { "idle", 1 },     // One at a time, with a pause between them
+    { "burst", 64 },   // Back to back in bursts of 64
+  };
+  for (const auto& pattern : patterns) {
+    LatencyHistogram latency;
+    for (size_t rep = 0; rep < settings.repetitions; rep++) {
+      for (size_t i = 0; i < nTasks; i++) {
+        if (i % pattern.second == 0) {
+          pool.waitUntilComplete();
+          const Clock::time_point until = Clock::now() + std::chrono::microseconds(50);
+          while (Clock::now() < until) {}
+        }
+        submitted[i] = Clock::now();
+        pool.addTask([&started, i]() { started[i] = Clock::now(); });
+      }
+      pool.waitUntilComplete();
+      for (size_t i = 0; i < nTasks; i++) {
+        latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            started[i] - submitted[i]).count());
+      }
+    }
+    const std::pair<const char*, double> percentiles[] = {
+      { "p50", 50.0 }, { "p90", 90.0 }, { "p99", 99.0 }, { "p99.9", 99.9 },
+    };
+    for (const auto& p : percentiles) {
+      results.push_back({ "latency", pattern.first, p.first,
+                          static_cast<double>(latency.percentile(p.second)), "ns" });
+    }
+    results.push_back({ "latency", pattern.first, "max",
+                        static_cast<double>(latency.max()), "ns" });
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void benchBarrier(const Settings& settings, std::vector<Result>& results) {
+  const size_t nBarriers = 20000 / settings.scale;
+  ThreadPool pool(settings.nThreads, &std::cerr);
+
+  const double empty = median(settings.repetitions, [&]() {
+    auto start = Clock::now();
+    for (size_t i = 0; i < nBarriers; i++)
+      pool.waitUntilComplete();
+    return seconds(start);
+  });
+  // One empty task per worker, then wait for them
+  const double full = median(settings.repetitions, [&]() {
+    auto start = Clock::now();
+    for (size_t i = 0; i < nBarriers; i++) {
+      for (size_t t = 0; t < settings.nThreads; t++)
+        pool.addTask([]() {});
+      pool.waitUntilComplete();
+    }
+    return seconds(start);
+  });
+  const double group = median(settings.repetitions, [&]() {
+    auto start = Clock::now();
+    for (size_t i = 0; i < nBarriers; i++) {
+      TaskGroup tasks(pool);
+      for (size_t t = 0; t < settings.nThreads; t++)
+        tasks.addTask([]() {});
+      tasks.wait();
+    }
+    return seconds(start);
+  });
+  results.push_back({ "barrier", "waitUntilComplete/no tasks", "time", empty * 1e9 / nBarriers, "ns" });
+  results.push_back({ "barrier", "waitUntilComplete/1 task per worker", "time",
+                      full * 1e9 / nBarriers, "ns" });
+  results.push_back({ "barrier", "TaskGroup::wait/1 task per worker", "time",
+                      group * 1e9 / nBarriers, "ns" });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void benchContention(const Settings& settings, std::vector<Result>& results) {
+  const size_t nTasks = 1000000 / settings.scale;
+  ThreadPool pool(settings.nThreads, &std::cerr);
+  for (size_t nProducers = 1; nProducers <= settings.maxProducers; nProducers *= 2) {
+    const double elapsed = median(settings.repetitions, [&]() {
+      std::atomic<bool> go(false);
+      std::vector<std::thread> producers;
+      for (size_t p = 0; p < nProducers; p++) {
+        producers.emplace_back([&pool, &go, n = nTasks / nProducers]() {
+          while (!go) {}
+          for (size_t i = 0; i < n; i++)
+            pool.addTask([]() {});
+        });
+      }
+      auto start = Clock::now();
+      go = true;
+      for (auto& producer : producers)
+        producer.join();
+      pool.waitUntilComplete();
+      return seconds(start);
+    });
+    results.push_back({ "contention", std::to_string(nProducers) + " producers", "throughput",
+                        (nTasks / nProducers) * nProducers / elapsed, "tasks/s" });
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+struct Payload {
+  Payload(double a = 0.0) : x{ a, a, a, a } {}
+  double x[4];
+};
+
+// Heap-free access to the value of each wrapper
+double valueOf(optional::Copyable<Payload>& p)    { return p ? p->x[0] : 0.0; }
+double valueOf(optional::NonCopyable<Payload>& p) { return p ? p->x[0] : 0.0; }
+double valueOf(std::optional<Payload>& p)         { return p ? p->x[0] : 0.0; }
+double valueOf(optional::InlineCopyable<Payload>& p)    { return p ? p->x[0] : 0.0; }
+double valueOf(optional::InlineNonCopyable<Payload>& p) { return p ? p->x[0] : 0.0; }
+
+template <typename Wrapper, typename Make>
+void benchWrapper(const Settings& settings, const std::string& name, Make make,
+                  std::vector<Result>& results) {
+  const size_t n = (1 << 20) / settings.scale;
+
+  std::vector<Wrapper> source;
+  const double construct = median(settings.repetitions, [&]() {
+    source.clear();
+    source.reserve(n);
+    auto start = Clock::now();
+    for (size_t i = 0; i < n; i++)
+      source.push_back(make(static_cast<double>(i)));
+    return seconds(start);
+  });
+  const double copy = median(settings.repetitions, [&]() {
+    auto start = Clock::now();
+    std::vector<Wrapper> copies(source);
+    double sum = 0.0;
+    for (auto& c : copies)
+      sum += valueOf(c);
+    keep(sum);
+    return seconds(start);
+  });
+  const double move = median(settings.repetitions, [&]() {
+    std::vector<Wrapper> from;
+    from.reserve(n);
+    for (size_t i = 0; i < n; i++)
+      from.push_back(make(static_cast<double>(i)));
+    std::vector<Wrapper> to;
+    to.reserve(n);
+    auto start = Clock::now();
+    for (auto& w : from)
+      to.push_back(std::move(w));
+    return seconds(start);
+  });
+  const double access = median(settings.repetitions, [&]() {
+    auto start = Clock::now();
+    double sum = 0.0;
+    for (auto& w : source)
+      sum += valueOf(w);
+    keep(sum);
+    return seconds(start);
+  });
+  results.push_back({ "optional", name, "construct", construct * 1e9 / n, "ns" });
+  results.push_back({ "optional", name, "copy", copy * 1e9 / n, "ns" });
+  results.push_back({ "optional", name, "move", move * 1e9 / n, "ns" });
+  results.push_back({ "optional", name, "access", access * 1e9 / n, "ns" });
+}
+
+void benchOptional(const Settings& settings, std::vector<Result>& results) {
+  benchWrapper<optional::Copyable<Payload>>(settings, "Copyable",
+      [](double v) { return optional::make_copyable<Payload>(v); }, results);
+  benchWrapper<optional::NonCopyable<Payload>>(settings, "NonCopyable",
+      [](double v) { return optional::make_noncopyable<Payload>(v); }, results);
+  benchWrapper<optional::InlineCopyable<Payload>>(settings, "InlineCopyable",
+      [](double v) { return optional::make_inline_copyable<Payload>(v); }, results);
+  benchWrapper<optional::InlineNonCopyable<Payload>>(settings, "InlineNonCopyable",
+      [](double v) { return optional::make_inline_noncopyable<Payload>(v); }, results);
+  benchWrapper<std::optional<Payload>>(settings, "std::optional",
+      [](double v) { return std::optional<Payload>(v); }, results);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::string jsonString(const std::string& s) {
+  std::string out = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      out += '\\';
+    out += c;
+  }
+  return out + "\"";
+}
+
+void write(const Settings& settings, const std::vector<Result>& results) {
+  if (settings.format == "json") {
+    std::cout << "{\n"
+              << "  \"context\": { \"threads\": " << settings.nThreads
+              << ", \"hardware_concurrency\": " << std::thread::hardware_concurrency()
+              << ", \"repetitions\": " << settings.repetitions
+              << ", \"quick\": " << (settings.scale > 1 ? "true" : "false") << " },\n"
+              << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+      const Result& r = results[i];
+      std::cout << "    { \"benchmark\": " << jsonString(r.benchmark)
+                << ", \"variant\": " << jsonString(r.variant)
+                << ", \"metric\": " << jsonString(r.metric)
+                << ", \"value\": " << r.value
+                << ", \"unit\": " << jsonString(r.unit) << " }"
+                << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    std::cout << "  ]\n}\n";
+  } else {
+    std::cout << "benchmark,variant,metric,value,unit\n";
+    for (const Result& r : results) {
+      std::cout << r.benchmark << "," << r.variant << "," << r.metric << ","
+                << r.value << "," << r.unit << "\n";
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  Settings settings;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    auto value = [&arg]() { return arg.substr(arg.find('=') + 1); };
+    if (arg.rfind("--format=", 0) == 0) {
+      settings.format = value();
+    } else if (arg.rfind("--threads=", 0) == 0) {
+      settings.nThreads = std::max<size_t>(1, std::strtoul(value().c_str(), nullptr, 10));
+    } else if (arg.rfind("--producers=", 0) == 0) {
+      settings.maxProducers = std::max<size_t>(1, std::strtoul(value().c_str(), nullptr, 10));
+    } else if (arg.rfind("--repetitions=", 0) == 0) {
+      settings.repetitions = std::max<size_t>(1, std::strtoul(value().c_str(), nullptr, 10));
+    } else if (arg == "--quick") {
+      settings.scale = 10;
+    } else if (arg.rfind("--filter=", 0) == 0) {
+      settings.filter = value();
+    } else {
+      std::cerr << "Usage: BenchmarkSuite [--format=csv|json] [--threads=N] [--producers=N]\n"
+                   "                      [--repetitions=N] [--quick] [--filter=name]\n";
+      return 1;
+    }
+  }
+  if (settings.format != "csv" && settings.format != "json") {
+    std::cerr << "Unknown format \"" << settings.format << "\" (expected csv or json)\n";
+    return 1;
+  }
+
+  const std::pair<const char*, void (*)(const Settings&, std::vector<Result>&)> benchmarks[] = {
+    { "addTask",    benchAddTask },
+    { "latency",    benchLatency },
+    { "barrier",    benchBarrier },
+    { "contention", benchContention },
+    { "optional",   benchOptional },
+  };
+  std::vector<Result> results;
+  for (const auto& benchmark : benchmarks) {
+    if (settings.filter.empty() || settings.filter == benchmark.first)
+      benchmark.second(settings, results);
+  }
+  write(settings, results);
+  return 0;
+}
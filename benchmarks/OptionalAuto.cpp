@@ -0,0 +1,127 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2016 Matthew Bedder (bedder@gmail.com)
+//
+// This code has been released under the MIT license. See the LICENSE file in
+// the project root for more information
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Compares Copyable<T> (always on the heap) against AutoCopyable<T> (which
+// picks niche, inline or heap storage for T at compile time) for:
+//    bool                    - niche storage
+//    std::reference_wrapper  - niche storage
+//    int                     - inline storage
+//    a 32 byte struct        - inline storage
+//    a 256 byte struct       - heap storage, as it is over the inline limit
+// over a large std::vector with every other element empty. We report the
+// bytes per element, and the time per element to build the vector, copy it,
+// and read the values that exist.
+//
+// Usage: OptionalAuto [nElements] [nRepetitions]
+////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Optional.h"
+
+using namespace helper::optional;
+using Clock = std::chrono::steady_clock;
+
+template <size_t N>
+struct Block {
+  Block(double a) { std::fill(x, x + N, a); }
+  double x[N];
+};
+
+static_assert(OptionalStorageOf<Block<4>>::value == OptionalStorageKind::Inline,
+              "A 32 byte struct should be stored inline");
+static_assert(OptionalStorageOf<Block<32>>::value == OptionalStorageKind::Heap,
+              "A 256 byte struct should be stored on the heap");
+
+double valueOf(bool b)                                  { return b ? 1.0 : 0.0; }
+double valueOf(int i)                                   { return static_cast<double>(i); }
+double valueOf(const std::reference_wrapper<double>& r) { return r.get(); }
+template <size_t N>
+double valueOf(const Block<N>& b)                       { return b.x[0]; }
+
+// Keeps a value alive, so the compiler can't optimise away what computed it
+template <typename T>
+void keep(const T& value) {
+  asm volatile("" : : "r"(&value) : "memory");
+}
+
+// The median of nRepetitions runs of f, in nanoseconds per element
+template <typename F>
+double measure(size_t nElements, size_t nRepetitions, F f) {
+  std::vector<double> samples;
+  for (size_t rep = 0; rep < nRepetitions; rep++) {
+    auto start = Clock::now();
+    f();
+    std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+    samples.push_back(elapsed.count() / nElements);
+  }
+  std::sort(samples.begin(), samples.end());
+  return samples[samples.size() / 2];
+}
+
+template <typename Wrapper, typename Make>
+void run(const std::string& name, size_t nElements, size_t nRepetitions, Make make) {
+  std::vector<Wrapper> values;
+  const double build = measure(nElements, nRepetitions, [&]() {
+    values.assign(nElements, Wrapper());
+    for (size_t i = 0; i < nElements; i += 2)
+      values[i] = make(i);
+  });
+  const double copy = measure(nElements, nRepetitions, [&]() {
+    std::vector<Wrapper> copies(values);
+    keep(copies.data());
+  });
+  const double read = measure(nElements, nRepetitions, [&]() {
+    double sum = 0.0;
+    for (const Wrapper& w : values)
+      sum += w ? valueOf(*w) : 0.0;
+    keep(sum);
+  });
+  std::cout << name << "\t" << sizeof(Wrapper) << " bytes"
+            << "\tbuild " << build << " ns\tcopy " << copy << " ns\tread " << read << " ns\n";
+}
+
+int main(int argc, char **argv) {
+  const size_t nElements    = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 1 << 20;
+  const size_t nRepetitions = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 5;
+
+  std::cout << "Optional storage selection (" << nElements << " elements, time per element)\n";
+
+  run<Copyable<bool>>("Copyable<bool>            ", nElements, nRepetitions,
+      [](size_t i) { return make_copyable<bool>(i % 4 == 0); });
+  run<AutoCopyable<bool>>("AutoCopyable<bool>        ", nElements, nRepetitions,
+      [](size_t i) { return make_auto_copyable<bool>(i % 4 == 0); });
+
+  double target = 1.0;
+  using Ref = std::reference_wrapper<double>;
+  run<Copyable<Ref>>("Copyable<reference>       ", nElements, nRepetitions,
+      [&target](size_t) { return make_copyable<Ref>(target); });
+  run<AutoCopyable<Ref>>("AutoCopyable<reference>   ", nElements, nRepetitions,
+      [&target](size_t) { return make_auto_copyable<Ref>(target); });
+
+  run<Copyable<int>>("Copyable<int>             ", nElements, nRepetitions,
+      [](size_t i) { return make_copyable<int>(static_cast<int>(i)); });
+  run<AutoCopyable<int>>("AutoCopyable<int>         ", nElements, nRepetitions,
+      [](size_t i) { return make_auto_copyable<int>(static_cast<int>(i)); });
+
+  run<Copyable<Block<4>>>("Copyable<32 byte struct>  ", nElements, nRepetitions,
+      [](size_t i) { return make_copyable<Block<4>>(static_cast<double>(i)); });
+  run<AutoCopyable<Block<4>>>("AutoCopyable<32 byte>     ", nElements, nRepetitions,
+      [](size_t i) { return make_auto_copyable<Block<4>>(static_cast<double>(i)); });
+
+  run<Copyable<Block<32>>>("Copyable<256 byte struct> ", nElements / 8, nRepetitions,
+      [](size_t i) { return make_copyable<Block<32>>(static_cast<double>(i)); });
+  run<AutoCopyable<Block<32>>>("AutoCopyable<256 byte>    ", nElements / 8, nRepetitions,
+      [](size_t i) { return make_auto_copyable<Block<32>>(static_cast<double>(i)); });
+  return 0;
+}
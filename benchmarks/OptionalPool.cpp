@@ -0,0 +1,93 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2016 Matthew Bedder (bedder@gmail.com)
+//
+// This code has been released under the MIT license. See the LICENSE file in
+// the project root for more information
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Measures per-task logging objects: each task gets a
+// NonCopyable<std::ostringstream>, writes a line to it, and drops it. We
+// compare making a new stream each time (make_noncopyable) against borrowing
+// one from an ObjectPool (which clears it when it is given back), both in a
+// plain loop and in tasks on a ThreadPool, and report the time per task and
+// how many streams the pool had to construct.
+//
+// Usage: OptionalPool [nThreads] [nTasks]
+////////////////////////////////////////////////////////////////////////////////
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "Optional.h"
+#include "ThreadPool.h"
+
+using namespace helper;
+using namespace helper::optional;
+
+// Writes a log line, as a task would
+void log(NonCopyable<std::ostringstream>& stream, size_t i) {
+  *stream << "task " << i << " finished\n";
+}
+
+template <typename F>
+double timePerTask(size_t nTasks, F f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count() / nTasks;
+}
+
+int main(int argc, char **argv) {
+  const size_t nThreads = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 4;
+  const size_t nTasks   = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 200000;
+
+  std::cout << "ObjectPool benchmark (" << nThreads << " threads, " << nTasks << " tasks)\n";
+
+  ObjectPool<std::ostringstream> pool([](std::ostringstream& s) {
+    s.str("");
+    s.clear();
+  });
+
+  const double loopNew = timePerTask(nTasks, [&]() {
+    for (size_t i = 0; i < nTasks; i++) {
+      NonCopyable<std::ostringstream> stream = make_noncopyable<std::ostringstream>();
+      log(stream, i);
+    }
+  });
+  const double loopPooled = timePerTask(nTasks, [&]() {
+    for (size_t i = 0; i < nTasks; i++) {
+      NonCopyable<std::ostringstream> stream = pool.acquire();
+      log(stream, i);
+    }
+  });
+  std::cout << "Loop      \tmake_noncopyable " << loopNew << " ns"
+            << "\tObjectPool " << loopPooled << " ns"
+            << "\t(" << pool.created() << " streams constructed)\n";
+
+  ThreadPool threads(nThreads, &std::cerr);
+  const double tasksNew = timePerTask(nTasks, [&]() {
+    for (size_t i = 0; i < nTasks; i++) {
+      threads.addTask([i]() {
+        NonCopyable<std::ostringstream> stream = make_noncopyable<std::ostringstream>();
+        log(stream, i);
+      });
+    }
+    threads.waitUntilComplete();
+  });
+  const double tasksPooled = timePerTask(nTasks, [&]() {
+    for (size_t i = 0; i < nTasks; i++) {
+      threads.addTask([&pool, i]() {
+        NonCopyable<std::ostringstream> stream = pool.acquire();
+        log(stream, i);
+      });
+    }
+    threads.waitUntilComplete();
+  });
+  std::cout << "ThreadPool\tmake_noncopyable " << tasksNew << " ns"
+            << "\tObjectPool " << tasksPooled << " ns"
+            << "\t(" << pool.created() << " streams constructed)\n";
+  return 0;
+}
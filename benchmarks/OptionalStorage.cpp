@@ -0,0 +1,225 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2016 Matthew Bedder (bedder@gmail.com)
+//
+// This code has been released under the MIT license. See the LICENSE file in
+// the project root for more information
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Compares the heap-backed Copyable/NonCopyable against InlineCopyable and
+// InlineNonCopyable, in tight loops over a large std::vector of each:
+//    construct - push_back a newly made wrapper into a reserved vector
+//    copy      - copy the whole vector
+//    access    - sum a member of every value
+//    move      - move every wrapper into another reserved vector
+// for a small trivially copyable payload, and for a std::string (long enough
+// to allocate itself). The heap-backed versions are also run with their values
+// allocated from a std::pmr arena. We report the time per element for each.
+//
+// Finally we compare Copyable against CowCopyable for a large, read-mostly
+// object, copied once per "task" and read through a const reference by each
+// copy (with one copy in every 100 written to).
+//
+// And we compare a std::vector<Copyable<T>> against an OptionalArray<T> where
+// only some slots hold a value, for building the array, summing the values
+// that exist, counting them, and copying the whole array.
+//
+// Usage: OptionalStorage [nElements] [nRepetitions]
+////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory_resource>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "Optional.h"
+
+using namespace helper::optional;
+using Clock = std::chrono::steady_clock;
+
+struct Payload {
+  Payload(double a) : x{ a, a, a, a } {}
+  double x[4];
+};
+
+static_assert(std::is_trivially_copyable<InlineCopyable<Payload>>::value,
+              "InlineCopyable of a trivially copyable type should be trivially copyable");
+static_assert(std::is_trivially_destructible<InlineNonCopyable<Payload>>::value,
+              "InlineNonCopyable of a trivially destructible type should be trivially destructible");
+
+double valueOf(const Payload& p)     { return p.x[0]; }
+double valueOf(const std::string& s) { return static_cast<double>(s[0]); }
+
+// Keeps a value alive, so the compiler can't optimise away what computed it
+template <typename T>
+void keep(const T& value) {
+  asm volatile("" : : "r"(&value) : "memory");
+}
+
+// The median of nRepetitions runs of f, in nanoseconds per element
+template <typename F>
+double measure(size_t nElements, size_t nRepetitions, F f) {
+  std::vector<double> samples;
+  for (size_t rep = 0; rep < nRepetitions; rep++) {
+    auto start = Clock::now();
+    f();
+    std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+    samples.push_back(elapsed.count() / nElements);
+  }
+  std::sort(samples.begin(), samples.end());
+  return samples[samples.size() / 2];
+}
+
+template <typename Wrapper, typename T, typename Make>
+void run(const std::string& name, size_t nElements, size_t nRepetitions, const T& value,
+         Make make) {
+  std::vector<Wrapper> source;
+  const double construct = measure(nElements, nRepetitions, [&]() {
+    source.clear();
+    source.reserve(nElements);
+    for (size_t i = 0; i < nElements; i++)
+      source.push_back(make(value));
+  });
+  const double copy = measure(nElements, nRepetitions, [&]() {
+    std::vector<Wrapper> copies(source);
+    keep(copies.data());
+  });
+  const double access = measure(nElements, nRepetitions, [&]() {
+    double sum = 0.0;
+    for (auto& w : source)
+      sum += w ? valueOf(*w) : 0.0;
+    keep(sum);
+  });
+  std::vector<Wrapper> from(source), to;
+  const double move = measure(nElements, 1, [&]() {
+    to.reserve(nElements);
+    for (auto& w : from)
+      to.push_back(std::move(w));
+  });
+
+  std::cout << name << "\tconstruct " << construct << " ns"
+            << "\tcopy " << copy << " ns"
+            << "\taccess " << access << " ns"
+            << "\tmove " << move << " ns\n";
+}
+
+// Copies a large object into nCopies wrappers, as capturing it in each of that
+// many tasks would, and reads it (or for every 100th copy, writes to it)
+template <typename Wrapper>
+void runShared(const std::string& name, size_t nCopies, size_t nRepetitions,
+               const Wrapper& config) {
+  const double perCopy = measure(nCopies, nRepetitions, [&]() {
+    std::vector<Wrapper> copies(nCopies, config);
+    double sum = 0.0;
+    for (size_t i = 0; i < nCopies; i++) {
+      if (i % 100 == 0)
+        (*copies[i])[0] = 1.0;
+      const Wrapper& copy = copies[i];
+      sum += (*copy)[i % copy->size()];
+    }
+    keep(sum);
+  });
+  std::cout << name << "\tcopy and read " << perCopy << " ns\n";
+}
+
+// Fills one slot in every `stride` of a std::vector<Copyable> and of an
+// OptionalArray, and times working with the values that exist
+void runSparse(size_t nElements, size_t nRepetitions, size_t stride) {
+  std::vector<Copyable<Payload>> vector;
+  OptionalArray<Payload> array(nElements);
+  const double buildVector = measure(nElements, nRepetitions, [&]() {
+    vector.assign(nElements, Copyable<Payload>());
+    for (size_t i = 0; i < nElements; i += stride)
+      vector[i] = make_copyable<Payload>(static_cast<double>(i));
+  });
+  const double buildArray = measure(nElements, nRepetitions, [&]() {
+    array.clear();
+    for (size_t i = 0; i < nElements; i += stride)
+      array.emplace(i, static_cast<double>(i));
+  });
+  const double sumVector = measure(nElements, nRepetitions, [&]() {
+    double sum = 0.0;
+    for (const auto& w : vector)
+      sum += w ? valueOf(*w) : 0.0;
+    keep(sum);
+  });
+  const double sumArray = measure(nElements, nRepetitions, [&]() {
+    double sum = 0.0;
+    for (const Payload& p : array)
+      sum += valueOf(p);
+    keep(sum);
+  });
+  const double countVector = measure(nElements, nRepetitions, [&]() {
+    size_t n = 0;
+    for (const auto& w : vector)
+      n += w ? 1 : 0;
+    keep(n);
+  });
+  const double countArray = measure(nElements, nRepetitions, [&]() {
+    keep(array.count());
+  });
+  const double copyVector = measure(nElements, nRepetitions, [&]() {
+    std::vector<Copyable<Payload>> copy(vector);
+    keep(copy.data());
+  });
+  const double copyArray = measure(nElements, nRepetitions, [&]() {
+    OptionalArray<Payload> copy(array);
+    keep(copy.size());
+  });
+
+  std::cout << "1 in " << stride << "\tvector<Copyable>\tbuild " << buildVector << " ns"
+            << "\tsum " << sumVector << " ns\tcount " << countVector << " ns"
+            << "\tcopy " << copyVector << " ns\n";
+  std::cout << "1 in " << stride << "\tOptionalArray   \tbuild " << buildArray << " ns"
+            << "\tsum " << sumArray << " ns\tcount " << countArray << " ns"
+            << "\tcopy " << copyArray << " ns\n";
+}
+
+int main(int argc, char **argv) {
+  const size_t nElements    = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 1 << 20;
+  const size_t nRepetitions = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 5;
+
+  std::cout << "Optional storage benchmark (" << nElements << " elements, time per element)\n";
+
+  // Memory given out by the arena is only freed when it is destroyed
+  std::pmr::monotonic_buffer_resource arena;
+
+  const Payload payload(1.0);
+  run<Copyable<Payload>>("Copyable<Payload>             ", nElements, nRepetitions, payload,
+      [](const Payload& p) { return make_copyable<Payload>(p); });
+  run<Copyable<Payload>>("Copyable<Payload> (arena)     ", nElements, nRepetitions, payload,
+      [&arena](const Payload& p) { return allocate_copyable<Payload>(&arena, p); });
+  run<InlineCopyable<Payload>>("InlineCopyable<Payload>       ", nElements, nRepetitions, payload,
+      [](const Payload& p) { return make_inline_copyable<Payload>(p); });
+  run<NonCopyable<Payload>>("NonCopyable<Payload>          ", nElements, nRepetitions, payload,
+      [](const Payload& p) { return make_noncopyable<Payload>(p); });
+  run<NonCopyable<Payload>>("NonCopyable<Payload> (arena)  ", nElements, nRepetitions, payload,
+      [&arena](const Payload& p) { return allocate_noncopyable<Payload>(&arena, p); });
+  run<InlineNonCopyable<Payload>>("InlineNonCopyable<Payload>    ", nElements, nRepetitions, payload,
+      [](const Payload& p) { return make_inline_noncopyable<Payload>(p); });
+
+  const std::string text(64, 'x');
+  run<Copyable<std::string>>("Copyable<std::string>         ", nElements, nRepetitions, text,
+      [](const std::string& s) { return make_copyable<std::string>(s); });
+  run<InlineCopyable<std::string>>("InlineCopyable<std::string>   ", nElements, nRepetitions, text,
+      [](const std::string& s) { return make_inline_copyable<std::string>(s); });
+  run<NonCopyable<std::string>>("NonCopyable<std::string>      ", nElements, nRepetitions, text,
+      [](const std::string& s) { return make_noncopyable<std::string>(s); });
+  run<InlineNonCopyable<std::string>>("InlineNonCopyable<std::string>", nElements, nRepetitions, text,
+      [](const std::string& s) { return make_inline_noncopyable<std::string>(s); });
+
+  const size_t nCopies = std::max<size_t>(1, nElements / 256);
+  std::cout << "\nSharing a 32 KB object (" << nCopies << " copies, time per copy)\n";
+  runShared("Copyable<std::vector<double>>   ", nCopies, nRepetitions,
+            make_copyable<std::vector<double>>(4096, 0.5));
+  runShared("CowCopyable<std::vector<double>>", nCopies, nRepetitions,
+            make_cow_copyable<std::vector<double>>(4096, 0.5));
+
+  std::cout << "\nSparse storage (" << nElements << " slots, time per slot)\n";
+  runSparse(nElements, nRepetitions, 2);
+  runSparse(nElements, nRepetitions, 16);
+  return 0;
+}
@@ -0,0 +1,145 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2016 Matthew Bedder (bedder@gmail.com)
+//
+// This code has been released under the MIT license. See the LICENSE file in
+// the project root for more information
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Compares running a pipeline as a TaskGraph against running it one stage at a
+// time with a waitUntilComplete barrier between stages.
+//
+// The pipeline is a grid of `width` x `depth` nodes, where each node depends on
+// two nodes of the previous stage. Nodes do a random amount of work, so with
+// barriers every stage waits for its slowest node, while the graph lets the
+// stages overlap.
+//
+// Global operator new is replaced to check that re-running a graph makes no
+// heap allocations; the program exits with a non-zero status if it does.
+//
+// Usage: TaskGraph [nThreads] [width] [depth] [nRuns]
+////////////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "TaskGraph.h"
+
+using namespace helper;
+
+std::atomic<size_t> g_allocations(0);
+
+void* operator new(size_t size) {
+  ++g_allocations;
+  if (void* p = std::malloc(size == 0 ? 1 : size))
+    return p;
+  throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept               { std::free(p); }
+void operator delete(void* p, size_t) noexcept       { std::free(p); }
+
+class Pipeline {
+public:
+  Pipeline(size_t width, size_t depth)
+  : width_(width), depth_(depth), cost_(width * depth), values_(width * depth) {
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> dist(100, 4000);
+    for (auto& c : cost_)
+      c = dist(rng);
+  }
+
+  size_t width() const { return width_; }
+  size_t depth() const { return depth_; }
+  const std::vector<double>& values() const { return values_; }
+
+  // Node (stage, column) combines columns `column` and `column + 1` of the
+  // previous stage
+  void runNode(size_t stage, size_t column) {
+    double x = (stage == 0) ? static_cast<double>(column)
+                            : values_[index(stage - 1, column)]
+                              + values_[index(stage - 1, (column + 1) % width_)];
+    for (int i = 0; i < cost_[index(stage, column)]; i++)
+      x = std::sqrt(x + i);
+    values_[index(stage, column)] = x;
+  }
+
+  size_t index(size_t stage, size_t column) const { return stage * width_ + column; }
+
+private:
+  size_t              width_, depth_;
+  std::vector<int>    cost_;
+  std::vector<double> values_;
+};
+
+void report(const std::string& name, size_t nRuns, double seconds, bool correct) {
+  std::cout << name << "\t" << seconds * 1000.0 / nRuns << " ms/run"
+            << (correct ? "" : "\tINCORRECT RESULT") << "\n";
+}
+
+int main(int argc, char **argv) {
+  const size_t nThreads = (argc > 1) ? std::strtoul(argv[1], nullptr, 10)
+                                     : std::max(1u, std::thread::hardware_concurrency());
+  const size_t width    = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 64;
+  const size_t depth    = (argc > 3) ? std::strtoul(argv[3], nullptr, 10) : 64;
+  const size_t nRuns    = (argc > 4) ? std::strtoul(argv[4], nullptr, 10) : 20;
+
+  ThreadPool pool(nThreads, &std::cerr);
+  Pipeline pipeline(width, depth);
+
+  std::cout << "TaskGraph benchmark (" << nThreads << " threads, "
+            << width << " x " << depth << " nodes, " << nRuns << " runs)\n";
+
+  // Serial reference
+  for (size_t s = 0; s < depth; s++)
+    for (size_t c = 0; c < width; c++)
+      pipeline.runNode(s, c);
+  const std::vector<double> expected = pipeline.values();
+
+  // One stage at a time
+  auto start = std::chrono::steady_clock::now();
+  for (size_t run = 0; run < nRuns; run++) {
+    for (size_t s = 0; s < depth; s++) {
+      for (size_t c = 0; c < width; c++)
+        pool.addTask([&pipeline, s, c]() { pipeline.runNode(s, c); });
+      pool.waitUntilComplete();
+    }
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  report("barrier per stage", nRuns, elapsed.count(), pipeline.values() == expected);
+
+  // As a graph
+  TaskGraph graph;
+  for (size_t s = 0; s < depth; s++) {
+    for (size_t c = 0; c < width; c++) {
+      TaskGraph::Node node = graph.addNode([&pipeline, s, c]() { pipeline.runNode(s, c); });
+      if (s > 0) {
+        graph.addEdge(pipeline.index(s - 1, c), node);
+        if (width > 1)
+          graph.addEdge(pipeline.index(s - 1, (c + 1) % width), node);
+      }
+    }
+  }
+  graph.run(pool);  // Warm up
+
+  const size_t before = g_allocations;
+  start = std::chrono::steady_clock::now();
+  for (size_t run = 0; run < nRuns; run++)
+    graph.run(pool);
+  elapsed = std::chrono::steady_clock::now() - start;
+  const size_t allocations = g_allocations - before;
+  report("TaskGraph        ", nRuns, elapsed.count(), pipeline.values() == expected);
+
+  if (allocations != 0) {
+    std::cerr << "FAILED: re-running the graph made " << allocations
+              << " heap allocations\n";
+    return 1;
+  }
+  return 0;
+}
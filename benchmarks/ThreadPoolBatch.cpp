@@ -0,0 +1,80 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2016 Matthew Bedder (bedder@gmail.com)
+//
+// This code has been released under the MIT license. See the LICENSE file in
+// the project root for more information
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Compares adding many small tasks with a loop of ThreadPool::addTask against
+// adding them all at once with ThreadPool::addTasks, for a shared queue (with
+// workers taking one task or a dequeueBatch of 16 at a time) and for work
+// stealing. We report the time per task from the first add until
+// waitUntilComplete returns, and the time per task spent adding them.
+//
+// Usage: ThreadPoolBatch [nThreads] [nTasks]
+////////////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "ThreadPool.h"
+
+using namespace helper;
+using Clock = std::chrono::steady_clock;
+
+double nsPerTask(Clock::duration elapsed, size_t nTasks) {
+  return std::chrono::duration<double, std::nano>(elapsed).count() / nTasks;
+}
+
+void run(const std::string& name, ThreadPoolOptions options, size_t nTasks) {
+  ThreadPool pool(options, &std::cerr);
+  std::atomic<size_t> sum(0);
+  std::vector<std::function<void()>> tasks;
+  tasks.reserve(nTasks);
+  for (size_t i = 0; i < nTasks; i++)
+    tasks.push_back([&sum, i]() { sum.fetch_add(i, std::memory_order_relaxed); });
+
+  auto start = Clock::now();
+  for (const auto& task : tasks)
+    pool.addTask(task);
+  const Clock::duration loopAdd = Clock::now() - start;
+  pool.waitUntilComplete();
+  const Clock::duration loopTotal = Clock::now() - start;
+
+  start = Clock::now();
+  pool.addTasks(tasks.begin(), tasks.end());
+  const Clock::duration batchAdd = Clock::now() - start;
+  pool.waitUntilComplete();
+  const Clock::duration batchTotal = Clock::now() - start;
+
+  if (sum != nTasks * (nTasks - 1))
+    std::cerr << name << ": tasks were lost\n";
+  std::cout << name
+            << "\taddTask loop " << nsPerTask(loopTotal, nTasks) << " ns"
+            << " (adding " << nsPerTask(loopAdd, nTasks) << " ns)"
+            << "\taddTasks " << nsPerTask(batchTotal, nTasks) << " ns"
+            << " (adding " << nsPerTask(batchAdd, nTasks) << " ns)\n";
+}
+
+int main(int argc, char **argv) {
+  const size_t nThreads = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 4;
+  const size_t nTasks   = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 200000;
+
+  std::cout << "Batch submission (" << nThreads << " threads, " << nTasks
+            << " tasks, time per task)\n";
+
+  ThreadPoolOptions options;
+  options.nThreads = nThreads;
+  run("SharedQueue            ", options, nTasks);
+  options.dequeueBatch = 16;
+  run("SharedQueue, batch 16  ", options, nTasks);
+  options.dequeueBatch = 1;
+  options.scheduling = SchedulingMode::WorkStealing;
+  run("WorkStealing           ", options, nTasks);
+  return 0;
+}
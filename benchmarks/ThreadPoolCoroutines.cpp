@@ -0,0 +1,140 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2016 Matthew Bedder (bedder@gmail.com)
+//
+// This code has been released under the MIT license. See the LICENSE file in
+// the project root for more information
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Measures the cost of running work on a ThreadPool from coroutines (Task.h):
+//    hops    - a coroutine doing co_await pool.schedule() repeatedly, against
+//              a chain of addTask callbacks where each task adds the next
+//    fan-out - whenAll over kFanOut small tasks at a time, against addTask for
+//              each one followed by waitUntilComplete
+// For the coroutines we also report the heap allocations per task once the
+// frame cache has warmed up (global operator new is replaced to count them).
+// Build with -DHELPER_TASK_FRAME_CACHE=0 to compare against plain new/delete.
+//
+// Needs C++20.
+//
+// Usage: ThreadPoolCoroutines [nThreads] [nHops] [nTasks]
+////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Task.h"
+
+using namespace helper;
+using Clock = std::chrono::steady_clock;
+
+std::atomic<size_t> g_allocations(0);
+
+void* operator new(size_t size) {
+  ++g_allocations;
+  if (void* p = std::malloc(size == 0 ? 1 : size))
+    return p;
+  throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept               { std::free(p); }
+void operator delete(void* p, size_t) noexcept       { std::free(p); }
+
+const size_t kFanOut = 256;
+
+void report(const std::string& name, double seconds, size_t n, size_t allocations) {
+  std::cout << name << "\t" << seconds * 1e9 / n << " ns/task"
+            << "\t" << static_cast<double>(allocations) / n << " allocations/task\n";
+}
+
+Task<void> hop(ThreadPool& pool, size_t nHops) {
+  for (size_t i = 0; i < nHops; i++)
+    co_await pool.schedule();
+}
+
+void callbackHop(ThreadPool& pool, size_t remaining, std::promise<void>& done) {
+  if (remaining == 0) {
+    done.set_value();
+    return;
+  }
+  pool.addTask([&pool, remaining, &done]() { callbackHop(pool, remaining - 1, done); });
+}
+
+Task<size_t> leaf(ThreadPool& pool, size_t i) {
+  co_await pool.schedule();
+  co_return i;
+}
+
+Task<size_t> fanOut(ThreadPool& pool, size_t nTasks) {
+  size_t total = 0;
+  for (size_t first = 0; first < nTasks; first += kFanOut) {
+    std::vector<Task<size_t>> tasks;
+    tasks.reserve(kFanOut);
+    for (size_t i = first; i < std::min(first + kFanOut, nTasks); i++)
+      tasks.push_back(leaf(pool, i));
+    for (size_t x : co_await whenAll(std::move(tasks)))
+      total += x;
+  }
+  co_return total;
+}
+
+int main(int argc, char **argv) {
+  const size_t nThreads = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 4;
+  const size_t nHops    = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 200000;
+  const size_t nTasks   = (argc > 3) ? std::strtoul(argv[3], nullptr, 10) : 100000;
+
+  ThreadPool pool(nThreads, &std::cerr);
+  std::cout << "ThreadPool coroutine benchmark (" << nThreads << " threads, "
+            << nHops << " hops, " << nTasks << " tasks"
+            << (HELPER_TASK_FRAME_CACHE ? "" : ", no frame cache") << ")\n";
+
+  // Hops
+  syncWait(hop(pool, 1000));  // Warm up
+  size_t before = g_allocations;
+  auto start = Clock::now();
+  syncWait(hop(pool, nHops));
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  report("co_await schedule  ", elapsed.count(), nHops, g_allocations - before);
+
+  before = g_allocations;
+  start = Clock::now();
+  {
+    std::promise<void> done;
+    callbackHop(pool, nHops, done);
+    done.get_future().wait();
+  }
+  elapsed = Clock::now() - start;
+  report("addTask chain      ", elapsed.count(), nHops, g_allocations - before);
+
+  // Fan-out
+  const size_t expected = nTasks * (nTasks - 1) / 2;
+  syncWait(fanOut(pool, nTasks));  // Warm up the frame cache
+  before = g_allocations;
+  start = Clock::now();
+  const bool correct = (syncWait(fanOut(pool, nTasks)) == expected);
+  elapsed = Clock::now() - start;
+  report("whenAll            ", elapsed.count(), nTasks, g_allocations - before);
+
+  std::atomic<size_t> total(0);
+  before = g_allocations;
+  start = Clock::now();
+  for (size_t first = 0; first < nTasks; first += kFanOut) {
+    for (size_t i = first; i < std::min(first + kFanOut, nTasks); i++)
+      pool.addTask([&total, i]() { total += i; });
+    pool.waitUntilComplete();
+  }
+  elapsed = Clock::now() - start;
+  report("addTask + wait     ", elapsed.count(), nTasks, g_allocations - before);
+
+  if (!correct || total != expected) {
+    std::cerr << "FAILED: incorrect result\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,89 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2016 Matthew Bedder (bedder@gmail.com)
+//
+// This code has been released under the MIT license. See the LICENSE file in
+// the project root for more information
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Measures submit-to-start latency (from addTask being called to the task
+// starting on a worker) for each IdlePolicy, with tasks arriving:
+//    steadily - one at a time, with a short gap between them
+//    sparsely - one at a time, with a long gap between them
+//    in bursts - batches of tasks added back to back, with a gap between
+//               batches
+// We also report the CPU time used by the whole process, which shows what
+// spinning costs.
+//
+// Usage: ThreadPoolIdle [nThreads] [nTasks]
+////////////////////////////////////////////////////////////////////////////////
+
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ThreadPool.h"
+
+using namespace helper;
+using Clock = std::chrono::steady_clock;
+
+struct Pattern {
+  std::string               name;
+  size_t                    burst;  // Tasks added back to back
+  std::chrono::microseconds gap;    // Between bursts
+};
+
+void run(const std::string& policyName, IdlePolicy policy, const Pattern& pattern,
+         size_t nThreads, size_t nTasks) {
+  ThreadPoolOptions options;
+  options.nThreads   = nThreads;
+  options.idlePolicy = policy;
+  ThreadPool pool(options, &std::cerr);
+
+  std::vector<Clock::time_point> submitted(nTasks), started(nTasks);
+  const std::clock_t cpuStart = std::clock();
+  for (size_t i = 0; i < nTasks; i++) {
+    if (i % pattern.burst == 0) {
+      // Busy-wait rather than sleep, so the gaps are the same for every policy
+      const Clock::time_point until = Clock::now() + pattern.gap;
+      while (Clock::now() < until) {}
+    }
+    submitted[i] = Clock::now();
+    pool.addTask([&started, i]() { started[i] = Clock::now(); });
+  }
+  pool.waitUntilComplete();
+  const double cpuMs = 1000.0 * (std::clock() - cpuStart) / CLOCKS_PER_SEC;
+
+  LatencyHistogram latency;
+  for (size_t i = 0; i < nTasks; i++) {
+    latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        started[i] - submitted[i]).count());
+  }
+  std::cout << policyName << "\t" << pattern.name
+            << "\tp50 " << latency.percentile(50) / 1000.0 << " us"
+            << "\tp99 " << latency.percentile(99) / 1000.0 << " us"
+            << "\tmax " << latency.max() / 1000.0 << " us"
+            << "\tCPU " << cpuMs << " ms\n";
+}
+
+int main(int argc, char **argv) {
+  const size_t nThreads = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 4;
+  const size_t nTasks   = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 2000;
+
+  const std::vector<Pattern> patterns = {
+    { "steady   ", 1,  std::chrono::microseconds(20) },
+    { "sparse   ", 1,  std::chrono::microseconds(1000) },
+    { "bursts   ", 32, std::chrono::microseconds(2000) },
+  };
+  std::cout << "ThreadPool submit-to-start latency (" << nThreads << " threads, "
+            << nTasks << " tasks)\n";
+  for (const Pattern& pattern : patterns) {
+    run("Park        ", IdlePolicy::Park,         pattern, nThreads, nTasks);
+    run("SpinThenPark", IdlePolicy::SpinThenPark, pattern, nThreads, nTasks);
+    run("Adaptive    ", IdlePolicy::Adaptive,     pattern, nThreads, nTasks);
+  }
+  return 0;
+}
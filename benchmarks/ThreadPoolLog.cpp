@@ -0,0 +1,62 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2016 Matthew Bedder (bedder@gmail.com)
+//
+// This code has been released under the MIT license. See the LICENSE file in
+// the project root for more information
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Measures an "exception storm": every task throws, so every task logs an
+// error. We compare a pool without a log stream (nothing is logged), against
+// one logging to a std::ostringstream, for a couple of log buffer sizes, and
+// report the time per task, how many records were written, and how many were
+// dropped because the buffers were full.
+//
+// Usage: ThreadPoolLog [nThreads] [nTasks]
+////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include "ThreadPool.h"
+
+using namespace helper;
+
+void run(const std::string& name, size_t nThreads, size_t nTasks, size_t logCapacity,
+         std::ostream* log) {
+  ThreadPoolOptions options;
+  options.nThreads    = nThreads;
+  options.logCapacity = logCapacity;
+  ThreadPool pool(options, log);
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < nTasks; i++)
+    pool.addTask([]() { throw std::runtime_error("Task failed"); });
+  pool.waitUntilComplete();
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  std::cout << name << "\t" << elapsed.count() * 1e9 / nTasks << " ns/task"
+            << "\tdropped " << pool.droppedLogMessages() << "\n";
+}
+
+int main(int argc, char **argv) {
+  const size_t nThreads = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 4;
+  const size_t nTasks   = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 200000;
+
+  std::cout << "ThreadPool logging benchmark (" << nThreads << " threads, "
+            << nTasks << " throwing tasks)\n";
+  run("no log        ", nThreads, nTasks, 256, nullptr);
+  for (size_t capacity : { 256, 16384 }) {
+    std::ostringstream log;
+    run("capacity " + std::to_string(capacity) + std::string(5 - std::to_string(capacity).size(), ' '),
+        nThreads, nTasks, capacity, &log);
+    const std::string written = log.str();
+    std::cout << "\t\t" << std::count(written.begin(), written.end(), '\n')
+              << " lines written\n";
+  }
+  return 0;
+}
@@ -0,0 +1,172 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2016 Matthew Bedder (bedder@gmail.com)
+//
+// This code has been released under the MIT license. See the LICENSE file in
+// the project root for more information
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Checks the per-node queues on a simulated topology of nNodes nodes with
+// coresPerNode cores each, with a worker per core that isn't pinned, so it can
+// be run on any box. For both the shared queue and work stealing:
+//    home  - with every worker held up, nTasks tasks are added with a NodeHint
+//            for one node or another. Once released, each worker must run the
+//            tasks for its own node before any for another node.
+//    steal - nTasks slow tasks are added with a NodeHint for node 0 only. The
+//            workers of the other nodes have nothing of their own to run, so
+//            they must take some of them.
+// We report how many tasks ran on their own node.
+//
+// The program exits with a non-zero status if either check fails.
+//
+// Usage: ThreadPoolNodeQueues [nNodes] [coresPerNode] [nTasks]
+////////////////////////////////////////////////////////////////////////////////
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ThreadPool.h"
+
+using namespace helper;
+
+// The nodes that the tasks each worker ran were sent to, in the order it ran
+// them. Each worker only appends to its own entry.
+using RunOrder = std::vector<std::vector<size_t>>;
+
+void record(ThreadPool& pool, RunOrder& order, size_t node) {
+  std::optional<size_t> worker = pool.workerIndex();
+  if (worker)
+    order[*worker].push_back(node);
+}
+
+// Holds up every worker of the pool until release() is called
+class Gate {
+public:
+  void hold(ThreadPool& pool, size_t nWorkers) {
+    // Each worker blocks in the first of these it takes, so each takes one
+    for (size_t i = 0; i < nWorkers; i++) {
+      pool.addTask([this]() {
+        std::unique_lock<std::mutex> lock(mt_);
+        ++held_;
+        cv_.notify_all();
+        cv_.wait(lock, [this]() { return open_; });
+      }, NodeHint{ i % pool.nodeCount() });
+    }
+    std::unique_lock<std::mutex> lock(mt_);
+    cv_.wait(lock, [this, nWorkers]() { return held_ == nWorkers; });
+  }
+
+  void release() {
+    std::lock_guard<std::mutex> guard(mt_);
+    open_ = true;
+    cv_.notify_all();
+  }
+
+private:
+  std::mutex              mt_;
+  std::condition_variable cv_;
+  size_t                  held_ = 0;
+  bool                    open_ = false;
+};
+
+// Once a worker has run a task for another node its own node's queue was
+// empty, and as no tasks are added while they run it must stay that way
+bool checkOrder(const std::string& name, const ThreadPool& pool, const RunOrder& order,
+                size_t& home, size_t& away) {
+  bool ok = true;
+  for (size_t worker = 0; worker < order.size(); worker++) {
+    const size_t node = pool.workerNode(worker);
+    std::optional<size_t> stolenFrom;
+    for (size_t hinted : order[worker]) {
+      if (hinted != node) {
+        stolenFrom = hinted;
+        ++away;
+      } else {
+        ++home;
+        if (stolenFrom) {
+          std::cerr << "FAILED: " << name << ": worker " << worker << " of node " << node
+                    << " ran a task for its own node after one for node " << *stolenFrom << "\n";
+          ok = false;
+          break;
+        }
+      }
+    }
+  }
+  return ok;
+}
+
+bool run(const std::string& name, ThreadPoolOptions options, size_t nTasks) {
+  const size_t nWorkers = options.nThreads;
+  ThreadPool pool(options, &std::cerr);
+  bool ok = true;
+
+  RunOrder order(nWorkers);
+  Gate gate;
+  gate.hold(pool, nWorkers);
+  for (size_t i = 0; i < nTasks; i++) {
+    // Not round-robin, so that spreading the tasks over the nodes without
+    // looking at the hints can't happen to put each one on the right node
+    const size_t node = (i * i + i / 2) % pool.nodeCount();
+    pool.addTask([&pool, &order, node]() {
+      volatile size_t x = 0;
+      for (size_t j = 0; j < 1000; j++)
+        x += j;
+      record(pool, order, node);
+    }, NodeHint{ node });
+  }
+  gate.release();
+  pool.waitUntilComplete();
+  size_t home = 0, away = 0;
+  ok &= checkOrder(name + " home", pool, order, home, away);
+  std::cout << name << "\thome\t" << home << " of " << (home + away)
+            << " tasks ran on their node\n";
+
+  order.assign(nWorkers, std::vector<size_t>());
+  for (size_t i = 0; i < nTasks; i++) {
+    pool.addTask([&pool, &order]() {
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+      record(pool, order, 0);
+    }, NodeHint{ 0 });
+  }
+  pool.waitUntilComplete();
+  home = away = 0;
+  ok &= checkOrder(name + " steal", pool, order, home, away);
+  std::cout << name << "\tsteal\t" << away << " of " << (home + away)
+            << " tasks for node 0 ran on other nodes\n";
+  if (away == 0) {
+    std::cerr << "FAILED: " << name << " steal: no other node took any of node 0's tasks\n";
+    ok = false;
+  }
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  const size_t nNodes       = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 3;
+  const size_t coresPerNode = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 2;
+  const size_t nTasks       = (argc > 3) ? std::strtoul(argv[3], nullptr, 10) : 600;
+
+  ThreadPoolOptions options;
+  options.topology   = CpuTopology::simulated(nNodes, coresPerNode);
+  options.placement  = WorkerPlacement::NumaNodes;
+  options.pinWorkers = false;
+  options.nThreads   = options.topology.coreCount();
+  if (options.topology.nodeCount() < 2) {
+    std::cerr << "ThreadPoolNodeQueues needs at least 2 nodes\n";
+    return 1;
+  }
+  std::cout << "ThreadPool node queue check (" << options.topology.nodeCount() << " nodes, "
+            << options.nThreads << " workers, " << nTasks << " tasks, simulated)\n";
+
+  bool ok = true;
+  options.scheduling = SchedulingMode::SharedQueue;
+  ok &= run("SharedQueue ", options, nTasks);
+  options.scheduling = SchedulingMode::WorkStealing;
+  ok &= run("WorkStealing", options, nTasks);
+  return ok ? 0 : 1;
+}
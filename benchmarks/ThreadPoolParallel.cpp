@@ -0,0 +1,133 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2016 Matthew Bedder (bedder@gmail.com)
+//
+// This code has been released under the MIT license. See the LICENSE file in
+// the project root for more information
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Compares the ThreadPool parallel algorithms against:
+//    the serial std:: algorithms
+//    one ThreadPool task per element (the way examples/ThreadPool.cpp loops)
+//    the C++17 std::execution::par overloads, when the build found a backend
+//    for them (HELPER_HAVE_STD_EXECUTION is defined by CMakeLists.txt)
+//
+// Usage: ThreadPoolParallel [nThreads] [nElements]
+////////////////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef HELPER_HAVE_STD_EXECUTION
+#include <execution>
+#endif
+#include "ThreadPool.h"
+
+using namespace helper;
+
+// Times `function`, then uses `check` to make sure it got the right answer
+template <typename F, typename Check>
+void measure(const std::string& algorithm, const std::string& variant, F function,
+             Check check) {
+  auto start = std::chrono::steady_clock::now();
+  function();
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << algorithm << "\t" << variant << "\t" << elapsed.count() * 1000.0 << " ms"
+            << (check() ? "" : "\tINCORRECT RESULT") << "\n";
+}
+
+double work(double x) { return std::sqrt(x) * std::sin(x); }
+
+int main(int argc, char **argv) {
+  const size_t nThreads  = (argc > 1) ? std::strtoul(argv[1], nullptr, 10)
+                                      : std::max(1u, std::thread::hardware_concurrency());
+  const size_t nElements = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 10000000;
+
+  ThreadPool pool(nThreads, &std::cerr);
+  std::vector<double> in(nElements), out(nElements), expected(nElements);
+  std::mt19937_64 rng(42);
+  std::uniform_real_distribution<double> dist(0.0, 1000.0);
+  for (auto& x : in)
+    x = dist(rng);
+
+  std::cout << "ThreadPool parallel algorithm benchmark ("
+            << nThreads << " threads, " << nElements << " elements)\n";
+
+  // for
+  measure("for      ", "std::for_each ", [&]() {
+    std::for_each(in.begin(), in.end(), [&](const double& x) { expected[&x - in.data()] = work(x); });
+  }, []() { return true; });
+  measure("for      ", "task/element  ", [&]() {
+    TaskGroup group(pool);
+    for (size_t i = 0; i < nElements; i++)
+      group.addTask([&, i]() { out[i] = work(in[i]); });
+  }, [&]() { return out == expected; });
+  std::fill(out.begin(), out.end(), 0.0);
+  measure("for      ", "parallelFor   ", [&]() {
+    pool.parallelFor(size_t(0), nElements, [&](size_t i) { out[i] = work(in[i]); });
+  }, [&]() { return out == expected; });
+#ifdef HELPER_HAVE_STD_EXECUTION
+  std::fill(out.begin(), out.end(), 0.0);
+  measure("for      ", "std::par      ", [&]() {
+    std::for_each(std::execution::par, in.begin(), in.end(),
+                  [&](const double& x) { out[&x - in.data()] = work(x); });
+  }, [&]() { return out == expected; });
+#endif
+
+  // reduce (the inputs are whole numbers so the sum is exact in any order)
+  std::vector<double> whole(nElements);
+  std::transform(in.begin(), in.end(), whole.begin(), [](double x) { return std::floor(x); });
+  double sum = 0.0;
+  measure("reduce   ", "std::accumulate", [&]() {
+    sum = std::accumulate(whole.begin(), whole.end(), 0.0);
+  }, []() { return true; });
+  double result = 0.0;
+  measure("reduce   ", "parallelReduce", [&]() {
+    result = pool.parallelReduce(whole.begin(), whole.end(), 0.0, std::plus<>());
+  }, [&]() { return result == sum; });
+#ifdef HELPER_HAVE_STD_EXECUTION
+  measure("reduce   ", "std::par      ", [&]() {
+    result = std::reduce(std::execution::par, whole.begin(), whole.end(), 0.0);
+  }, [&]() { return result == sum; });
+#endif
+
+  // transform
+  measure("transform", "std::transform", [&]() {
+    std::transform(in.begin(), in.end(), expected.begin(), work);
+  }, []() { return true; });
+  std::fill(out.begin(), out.end(), 0.0);
+  measure("transform", "parallelTransform", [&]() {
+    pool.parallelTransform(in.begin(), in.end(), out.begin(), work);
+  }, [&]() { return out == expected; });
+#ifdef HELPER_HAVE_STD_EXECUTION
+  std::fill(out.begin(), out.end(), 0.0);
+  measure("transform", "std::par      ", [&]() {
+    std::transform(std::execution::par, in.begin(), in.end(), out.begin(), work);
+  }, [&]() { return out == expected; });
+#endif
+
+  // sort
+  expected = in;
+  measure("sort     ", "std::sort     ", [&]() {
+    std::sort(expected.begin(), expected.end());
+  }, []() { return true; });
+  out = in;
+  measure("sort     ", "parallelSort  ", [&]() {
+    pool.parallelSort(out.begin(), out.end());
+  }, [&]() { return out == expected; });
+#ifdef HELPER_HAVE_STD_EXECUTION
+  out = in;
+  measure("sort     ", "std::par      ", [&]() {
+    std::sort(std::execution::par, out.begin(), out.end());
+  }, [&]() { return out == expected; });
+#endif
+  return 0;
+}
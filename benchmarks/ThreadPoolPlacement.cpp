@@ -0,0 +1,107 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2016 Matthew Bedder (bedder@gmail.com)
+//
+// This code has been released under the MIT license. See the LICENSE file in
+// the project root for more information
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Compares worker placements on a memory-bound workload. Each NUMA node gets
+// a buffer that is first touched (and so allocated) by a task running on that
+// node, and tasks summing a slice of a buffer are added with a NodeHint for
+// the buffer's node. We report the time taken, and how many tasks ran on a
+// worker of the node they were sent to.
+//
+// The topology is read from sysfs, unless nNodes is given, in which case a
+// machine of nNodes nodes with coresPerNode cores each is simulated (and the
+// workers aren't pinned), so the per-node queues can be tried on any box.
+//
+// Usage: ThreadPoolPlacement [nThreads] [nNodes coresPerNode]
+////////////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ThreadPool.h"
+
+using namespace helper;
+
+const size_t kBufferSize = 1 << 22;  // Doubles per node
+const size_t kSliceSize  = 1 << 14;
+const size_t kPasses     = 8;
+
+void run(const std::string& name, const ThreadPoolOptions& options) {
+  ThreadPool pool(options, &std::cerr);
+  const size_t nNodes = options.topology.nodeCount();
+
+  // Allocate each node's buffer from one of its workers, so that the kernel's
+  // first-touch policy puts the memory on that node
+  std::vector<std::unique_ptr<double[]>> buffers(nNodes);
+  for (size_t node = 0; node < nNodes; node++) {
+    pool.addTask([&buffers, node]() {
+      buffers[node].reset(new double[kBufferSize]);
+      std::iota(buffers[node].get(), buffers[node].get() + kBufferSize, 0.0);
+    }, NodeHint{ node });
+  }
+  pool.waitUntilComplete();
+
+  std::atomic<size_t> home(0), away(0);
+  std::atomic<uint64_t> total(0);
+  auto start = std::chrono::steady_clock::now();
+  for (size_t pass = 0; pass < kPasses; pass++) {
+    for (size_t slice = 0; slice < kBufferSize; slice += kSliceSize) {
+      for (size_t node = 0; node < nNodes; node++) {
+        pool.addTask([&, node, slice]() {
+          const double* data = buffers[node].get() + slice;
+          total += static_cast<uint64_t>(std::accumulate(data, data + kSliceSize, 0.0));
+          std::optional<size_t> worker = pool.workerIndex();
+          ++((worker && pool.workerNode(*worker) == node % pool.nodeCount()) ? home : away);
+        }, NodeHint{ node });
+      }
+    }
+  }
+  pool.waitUntilComplete();
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  std::cout << name << "\t" << elapsed.count() * 1000.0 << " ms";
+  if (pool.nodeCount() > 1)
+    std::cout << "\t" << 100.0 * home / (home + away) << "% of tasks ran on their node";
+  std::cout << "\n";
+}
+
+int main(int argc, char **argv) {
+  const size_t nThreads = (argc > 1) ? std::strtoul(argv[1], nullptr, 10)
+                                     : std::max(1u, std::thread::hardware_concurrency());
+  const bool simulate   = (argc > 3);
+
+  ThreadPoolOptions options;
+  options.nThreads   = nThreads;
+  options.scheduling = SchedulingMode::WorkStealing;
+  if (simulate) {
+    options.topology   = CpuTopology::simulated(std::strtoul(argv[2], nullptr, 10),
+                                                std::strtoul(argv[3], nullptr, 10));
+    options.pinWorkers = false;
+  } else {
+    options.topology   = CpuTopology::detect();
+  }
+  std::cout << "ThreadPool placement benchmark (" << nThreads << " threads, "
+            << options.topology.nodeCount() << " nodes, "
+            << options.topology.coreCount() << " cores, "
+            << options.topology.cpus().size() << " CPUs"
+            << (simulate ? ", simulated" : "") << ")\n";
+
+  run("None         ", options);
+  options.placement = WorkerPlacement::NumaNodes;
+  run("NumaNodes    ", options);
+  options.placement = WorkerPlacement::PhysicalCores;
+  run("PhysicalCores", options);
+  return 0;
+}
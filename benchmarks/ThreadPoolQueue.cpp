@@ -0,0 +1,89 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2016 Matthew Bedder (bedder@gmail.com)
+//
+// This code has been released under the MIT license. See the LICENSE file in
+// the project root for more information
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Measures task queue contention with 1, 4, 16 and 64 producer threads adding
+// empty tasks to a ThreadPool, comparing:
+//    the default unbounded, mutex-guarded queue
+//    a bounded lock-free queue with each QueueFullPolicy
+//
+// Usage: ThreadPoolQueue [nThreads] [nTasks] [queueCapacity]
+////////////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ThreadPool.h"
+
+using namespace helper;
+
+struct Result {
+  double seconds;
+  size_t completed;
+};
+
+Result produce(const ThreadPoolOptions& options, size_t nProducers, size_t nTasks) {
+  ThreadPool pool(options);  // No log, as Reject logs every dropped task
+  std::atomic<size_t> completed(0);
+  std::vector<std::thread> producers;
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t p = 0; p < nProducers; p++) {
+    producers.emplace_back([&pool, &completed, nTasks, nProducers]() {
+      for (size_t i = 0; i < nTasks / nProducers; i++)
+        pool.addTask([&completed]() { completed.fetch_add(1, std::memory_order_relaxed); });
+    });
+  }
+  for (auto& producer : producers)
+    producer.join();
+  pool.waitUntilComplete();
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return { elapsed.count(), completed };
+}
+
+int main(int argc, char **argv) {
+  const size_t nThreads = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 4;
+  const size_t nTasks   = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 256000;
+  const size_t capacity = (argc > 3) ? std::strtoul(argv[3], nullptr, 10) : 1024;
+
+  struct Variant {
+    std::string     name;
+    size_t          capacity;
+    QueueFullPolicy policy;
+  };
+  const std::vector<Variant> variants = {
+    { "unbounded (mutex)     ", 0,        QueueFullPolicy::Block      },
+    { "bounded   (Block)     ", capacity, QueueFullPolicy::Block      },
+    { "bounded   (Reject)    ", capacity, QueueFullPolicy::Reject     },
+    { "bounded   (CallerRuns)", capacity, QueueFullPolicy::CallerRuns },
+    { "bounded   (DropOldest)", capacity, QueueFullPolicy::DropOldest },
+  };
+
+  std::cout << "ThreadPool queue contention benchmark (" << nThreads << " workers, "
+            << nTasks << " tasks, capacity " << capacity << ")\n";
+  for (size_t nProducers : { 1, 4, 16, 64 }) {
+    for (const Variant& variant : variants) {
+      ThreadPoolOptions options;
+      options.nThreads      = nThreads;
+      options.queueCapacity = variant.capacity;
+      options.fullPolicy    = variant.policy;
+
+      // Reject and DropOldest lose tasks when the queue fills up, so we report
+      // how many actually ran
+      Result r = produce(options, nProducers, nTasks);
+      std::cout << variant.name << "\t" << nProducers << " producers\t"
+                << r.seconds * 1000.0 << " ms\t"
+                << r.completed / r.seconds << " tasks/s\t"
+                << r.completed << " tasks run\n";
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,71 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2016 Matthew Bedder (bedder@gmail.com)
+//
+// This code has been released under the MIT license. See the LICENSE file in
+// the project root for more information
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Runs a bursty workload (bursts of tasks that block for a while, as if
+// waiting on I/O, separated by quiet periods) on a fixed size pool and on an
+// autoscaling one. For each burst we report how long it took to finish, and
+// for the autoscaling pool how many workers it had at the end of the burst
+// and after the quiet period that followed.
+//
+// Usage: ThreadPoolResize [nThreads] [maxThreads] [nBursts]
+////////////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ThreadPool.h"
+
+using namespace helper;
+
+const size_t                    kBurstSize = 256;
+const std::chrono::microseconds kTaskTime(500);
+const std::chrono::milliseconds kQuietTime(300);
+
+void run(const std::string& name, const ThreadPoolOptions& options, size_t nBursts) {
+  ThreadPool pool(options, &std::cerr);
+  double total = 0.0;
+  for (size_t burst = 0; burst < nBursts; burst++) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < kBurstSize; i++)
+      pool.addTask([]() { std::this_thread::sleep_for(kTaskTime); });
+    pool.waitUntilComplete();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    total += elapsed.count();
+    const size_t busyWorkers = pool.workerCount();
+
+    std::this_thread::sleep_for(kQuietTime);
+    std::cout << name << "\tburst " << burst << "\t" << elapsed.count() * 1000.0 << " ms"
+              << "\tworkers " << busyWorkers << " -> " << pool.workerCount() << "\n";
+  }
+  std::cout << name << "\ttotal\t" << total * 1000.0 << " ms\n";
+}
+
+int main(int argc, char **argv) {
+  const size_t nThreads   = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 2;
+  const size_t maxThreads = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 32;
+  const size_t nBursts    = (argc > 3) ? std::strtoul(argv[3], nullptr, 10) : 4;
+
+  std::cout << "ThreadPool resize benchmark (" << nThreads << " threads, up to "
+            << maxThreads << ", " << nBursts << " bursts of " << kBurstSize << " tasks)\n";
+
+  ThreadPoolOptions options;
+  options.nThreads   = nThreads;
+  options.maxThreads = maxThreads;
+  run("fixed    ", options, nBursts);
+
+  options.autoscale       = true;
+  options.minThreads      = nThreads;
+  options.targetQueueWait = std::chrono::milliseconds(2);
+  options.keepAlive       = std::chrono::milliseconds(100);
+  run("autoscale", options, nBursts);
+  return 0;
+}
@@ -0,0 +1,96 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2016 Matthew Bedder (bedder@gmail.com)
+//
+// This code has been released under the MIT license. See the LICENSE file in
+// the project root for more information
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Compares the throughput of the two ThreadPool scheduling modes:
+//    SchedulingMode::SharedQueue   (a single mutex-guarded queue)
+//    SchedulingMode::WorkStealing  (per-worker deques plus an injection queue)
+//
+// Two workloads are measured:
+//    external - the main thread adds lots of tiny tasks to the pool
+//    fan-out  - a handful of root tasks recursively add child tasks, which is
+//               where work stealing should shine
+//
+// Usage: ThreadPoolScheduling [nThreads] [nTasks]
+////////////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include "ThreadPool.h"
+
+using namespace helper;
+
+// Spin (politely) until `counter` reaches `target`. We don't use
+// waitUntilComplete here as we only want to time the tasks themselves.
+void waitFor(const std::atomic<size_t>& counter, size_t target) {
+  while (counter.load() < target)
+    std::this_thread::yield();
+}
+
+double externalTasks(ThreadPool& pool, size_t nTasks) {
+  std::atomic<size_t> done(0);
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < nTasks; i++)
+    pool.addTask([&done]() { ++done; });
+  waitFor(done, nTasks);
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+void fanOut(ThreadPool& pool, std::atomic<size_t>& done, size_t depth) {
+  ++done;
+  if (depth == 0)
+    return;
+  pool.addTask([&pool, &done, depth]() { fanOut(pool, done, depth - 1); });
+  pool.addTask([&pool, &done, depth]() { fanOut(pool, done, depth - 1); });
+}
+
+double fanOutTasks(ThreadPool& pool, size_t nTasks) {
+  // A binary tree of depth d has 2^(d+1)-1 nodes
+  size_t depth = 0;
+  while ((size_t(2) << (depth + 1)) - 1 <= nTasks)
+    depth++;
+  const size_t total = (size_t(2) << depth) - 1;
+
+  std::atomic<size_t> done(0);
+  auto start = std::chrono::steady_clock::now();
+  pool.addTask([&pool, &done, depth]() { fanOut(pool, done, depth); });
+  waitFor(done, total);
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+void report(const std::string& mode, const std::string& workload,
+            size_t nTasks, double seconds) {
+  std::cout << mode << "\t" << workload << "\t" << nTasks << " tasks\t"
+            << seconds * 1000.0 << " ms\t"
+            << nTasks / seconds << " tasks/s\n";
+}
+
+int main(int argc, char **argv) {
+  const size_t nThreads = (argc > 1) ? std::strtoul(argv[1], nullptr, 10)
+                                     : std::max(1u, std::thread::hardware_concurrency());
+  const size_t nTasks   = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 200000;
+
+  std::cout << "ThreadPool scheduling benchmark (" << nThreads << " threads)\n";
+  for (SchedulingMode mode : { SchedulingMode::SharedQueue, SchedulingMode::WorkStealing }) {
+    const std::string name = (mode == SchedulingMode::SharedQueue) ? "SharedQueue "
+                                                                   : "WorkStealing";
+    ThreadPoolOptions options;
+    options.nThreads   = nThreads;
+    options.scheduling = mode;
+    ThreadPool pool(options, &std::cerr);
+
+    report(name, "external", nTasks, externalTasks(pool, nTasks));
+    report(name, "fan-out ", nTasks, fanOutTasks(pool, nTasks));
+  }
+  return 0;
+}
@@ -0,0 +1,100 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2016 Matthew Bedder (bedder@gmail.com)
+//
+// This code has been released under the MIT license. See the LICENSE file in
+// the project root for more information
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Shows the ThreadPool instrumentation (which this file turns on by defining
+// HELPER_THREADPOOL_STATS) on a mix of short and long tasks, some of which add
+// more tasks, and measures what the counters and the trace cost per task.
+//
+// If a trace file is given the last tasks run by each worker are written to
+// it, ready to be opened in chrome://tracing or https://ui.perfetto.dev
+//
+// Usage: ThreadPoolStats [nThreads] [nTasks] [traceFile]
+////////////////////////////////////////////////////////////////////////////////
+
+#define HELPER_THREADPOOL_STATS 1
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include "ThreadPool.h"
+
+using namespace helper;
+
+double work(size_t n) {
+  double x = 0.0;
+  for (size_t i = 0; i < n; i++)
+    x += std::sqrt(static_cast<double>(i));
+  return x;
+}
+
+// Runs the workload, returning the time taken in seconds
+double runWorkload(ThreadPool& pool, size_t nTasks) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < nTasks; i++) {
+    pool.addTask([&pool, i]() {
+      volatile double x = work((i % 16 == 0) ? 20000 : 200);
+      if (i % 8 == 0)
+        pool.addTask([]() { volatile double y = work(100); (void)y; });
+      (void)x;
+    });
+  }
+  pool.waitUntilComplete();
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+void printHistogram(const std::string& name, const LatencyHistogram& histogram) {
+  std::cout << name << "\tmean " << histogram.mean() << " ns"
+            << "\tp50 " << histogram.percentile(50) << " ns"
+            << "\tp99 " << histogram.percentile(99) << " ns"
+            << "\tp99.9 " << histogram.percentile(99.9) << " ns"
+            << "\tmax " << histogram.max() << " ns\n";
+}
+
+int main(int argc, char **argv) {
+  const size_t nThreads = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 4;
+  const size_t nTasks   = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 100000;
+
+  ThreadPoolOptions options;
+  options.nThreads      = nThreads;
+  options.scheduling    = SchedulingMode::WorkStealing;
+  options.traceCapacity = 4096;
+  ThreadPool pool(options, &std::cerr);
+  const double seconds = runWorkload(pool, nTasks);
+
+  const ThreadPoolStats stats = pool.stats();
+  std::cout << "ThreadPool stats (" << nThreads << " threads, " << nTasks << " tasks, "
+            << seconds * 1000.0 << " ms)\n";
+  for (size_t i = 0; i < stats.workers.size(); i++) {
+    const ThreadPoolStats::Worker& w = stats.workers[i];
+    std::cout << ((i + 1 < stats.workers.size()) ? "worker " + std::to_string(i) : "other   ")
+              << "\t" << w.tasksRun << " tasks\t" << w.steals << " steals"
+              << "\tbusy " << w.busyTime / 1e6 << " ms\tidle " << w.idleTime / 1e6 << " ms"
+              << "\tqueue high-water " << w.queueHighWater << "\n";
+  }
+  printHistogram("queue wait", stats.queueWait);
+  printHistogram("run time  ", stats.runTime);
+
+  if (argc > 3) {
+    std::ofstream trace(argv[3]);
+    pool.writeTrace(trace);
+    std::cout << "Trace written to " << argv[3] << "\n";
+  }
+
+  // The same workload without the trace, to see what the counters alone cost
+  options.traceCapacity = 0;
+  ThreadPool untraced(options, &std::cerr);
+  const double untracedSeconds = runWorkload(untraced, nTasks);
+  std::cout << "with trace " << seconds * 1e9 / nTasks << " ns/task\t"
+            << "without trace " << untracedSeconds * 1e9 / nTasks << " ns/task\n";
+  return 0;
+}
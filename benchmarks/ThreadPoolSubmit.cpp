@@ -0,0 +1,154 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2016 Matthew Bedder (bedder@gmail.com)
+//
+// This code has been released under the MIT license. See the LICENSE file in
+// the project root for more information
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Measures the cost of ThreadPool::submit, and counts the heap allocations made
+// on the submit -> run -> get path. Global operator new is replaced so that
+// every allocation (on any thread) is counted.
+//
+// Once the pool has warmed up (its queue has grown and the per-thread
+// TaskState cache is populated) submit() should make no allocations at all.
+// For comparison we also count the allocations made by the usual
+// std::packaged_task + std::function approach.
+//
+// The program exits with a non-zero status if the steady-state submit path
+// allocates.
+//
+// Usage: ThreadPoolSubmit [nThreads] [nTasks]
+////////////////////////////////////////////////////////////////////////////////
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ThreadPool.h"
+
+using namespace helper;
+
+std::atomic<size_t> g_allocations(0);
+
+void* operator new(size_t size) {
+  ++g_allocations;
+  if (void* p = std::malloc(size == 0 ? 1 : size))
+    return p;
+  throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept               { std::free(p); }
+void operator delete(void* p, size_t) noexcept       { std::free(p); }
+
+// A move-only payload of 64 bytes, which is too big for std::function's small
+// buffer and can't be stored in a std::function at all
+struct Payload {
+  std::array<uint64_t, 8> values;
+  Payload(uint64_t seed) { for (auto& v : values) v = seed++; }
+  Payload(Payload&&) = default;
+  Payload(const Payload&) = delete;
+  uint64_t sum() const { uint64_t s = 0; for (auto v : values) s += v; return s; }
+};
+
+struct Result {
+  double seconds;
+  size_t allocations;
+};
+
+// Submit batches of `batch` tasks and collect their results
+Result submitBatches(ThreadPool& pool, size_t nTasks, size_t batch) {
+  std::vector<TaskFuture<uint64_t>> futures;
+  futures.reserve(batch);
+  uint64_t total = 0;
+
+  const size_t before = g_allocations;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t done = 0; done < nTasks; done += batch) {
+    for (size_t i = 0; i < batch; i++)
+      futures.push_back(pool.submit([](Payload p) { return p.sum(); }, Payload(i)));
+    for (auto& f : futures)
+      total += f.get();
+    futures.clear();
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  if (total == 0)
+    std::cout << "";  // Stop the work being optimised away
+  return { elapsed.count(), g_allocations - before };
+}
+
+// The same workload using std::packaged_task, shared via std::shared_ptr so it
+// can be wrapped in a (copyable) std::function
+Result packagedTaskBatches(ThreadPool& pool, size_t nTasks, size_t batch) {
+  std::vector<std::future<uint64_t>> futures;
+  futures.reserve(batch);
+  uint64_t total = 0;
+
+  const size_t before = g_allocations;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t done = 0; done < nTasks; done += batch) {
+    for (size_t i = 0; i < batch; i++) {
+      auto payload = std::make_shared<Payload>(i);
+      auto task = std::make_shared<std::packaged_task<uint64_t()>>(
+          [payload]() { return payload->sum(); });
+      futures.push_back(task->get_future());
+      pool.addTask(std::function<void()>([task]() { (*task)(); }));
+    }
+    for (auto& f : futures)
+      total += f.get();
+    futures.clear();
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  if (total == 0)
+    std::cout << "";
+  return { elapsed.count(), g_allocations - before };
+}
+
+void report(const std::string& name, size_t nTasks, const Result& r) {
+  std::cout << name << "\t" << nTasks << " tasks\t"
+            << r.seconds * 1000.0 << " ms\t"
+            << nTasks / r.seconds << " tasks/s\t"
+            << static_cast<double>(r.allocations) / nTasks << " allocations/task\n";
+}
+
+int main(int argc, char **argv) {
+  const size_t nThreads = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 4;
+  const size_t nTasks   = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 100000;
+  const size_t batch    = 128;
+
+  ThreadPool pool(nThreads, &std::cerr);
+
+  // Warm up: hold the workers while a full batch is queued (so the task queue
+  // grows to its final size), which also fills this thread's TaskState cache
+  {
+    std::atomic<bool> release(false);
+    TaskGroup holders(pool);
+    for (size_t i = 0; i < nThreads; i++)
+      holders.addTask([&release]() { while (!release) std::this_thread::yield(); });
+    std::vector<TaskFuture<uint64_t>> futures;
+    for (size_t i = 0; i < batch; i++)
+      futures.push_back(pool.submit([](Payload p) { return p.sum(); }, Payload(i)));
+    release = true;
+    for (auto& f : futures)
+      f.get();
+  }
+  submitBatches(pool, batch * 4, batch);
+
+  std::cout << "ThreadPool submit benchmark (" << nThreads << " threads)\n";
+  Result submitted = submitBatches(pool, nTasks, batch);
+  report("submit       ", nTasks, submitted);
+  report("packaged_task", nTasks, packagedTaskBatches(pool, nTasks, batch));
+
+  if (submitted.allocations != 0) {
+    std::cerr << "FAILED: submit made " << submitted.allocations
+              << " heap allocations after warm-up\n";
+    return 1;
+  }
+  return 0;
+}
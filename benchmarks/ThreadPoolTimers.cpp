@@ -0,0 +1,108 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2016 Matthew Bedder (bedder@gmail.com)
+//
+// This code has been released under the MIT license. See the LICENSE file in
+// the project root for more information
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Measures ThreadPool's timers with many pending at once. nTimers timers are
+// added with random delays of up to maxDelayMs, and every other one is then
+// cancelled. We report the cost of adding and cancelling a timer (against
+// inserting into and erasing from a std::multimap ordered by due time, the
+// obvious alternative), and how late the remaining timers' tasks started. The
+// delays start 500ms from now, so that the timers aren't firing while they're
+// still being added.
+//
+// Usage: ThreadPoolTimers [nThreads] [nTimers] [maxDelayMs]
+////////////////////////////////////////////////////////////////////////////////
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <random>
+#include <vector>
+#include "ThreadPool.h"
+
+using namespace helper;
+using Clock = std::chrono::steady_clock;
+
+double nsPer(Clock::time_point start, size_t n) {
+  return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / n;
+}
+
+int main(int argc, char **argv) {
+  const size_t nThreads   = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 4;
+  const size_t nTimers    = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 200000;
+  const size_t maxDelayMs = (argc > 3) ? std::strtoul(argv[3], nullptr, 10) : 2000;
+
+  std::cout << "ThreadPool timer benchmark (" << nThreads << " threads, " << nTimers
+            << " timers, delays up to " << maxDelayMs << " ms)\n";
+
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<size_t> dist(0, maxDelayMs * 1000);
+  std::vector<Clock::duration> delays(nTimers);
+  for (auto& d : delays)
+    d = std::chrono::microseconds(dist(rng));
+
+  // std::multimap, for comparison
+  {
+    std::multimap<Clock::time_point, size_t> timers;
+    std::vector<std::multimap<Clock::time_point, size_t>::iterator> handles(nTimers);
+    const Clock::time_point now = Clock::now();
+    auto start = Clock::now();
+    for (size_t i = 0; i < nTimers; i++)
+      handles[i] = timers.emplace(now + delays[i], i);
+    const double addNs = nsPer(start, nTimers);
+    start = Clock::now();
+    for (size_t i = 0; i < nTimers; i += 2)
+      timers.erase(handles[i]);
+    const double cancelNs = nsPer(start, (nTimers + 1) / 2);
+    std::cout << "std::multimap\tadd " << addNs << " ns\tcancel " << cancelNs << " ns\n";
+  }
+
+  // ThreadPool
+  ThreadPool pool(nThreads, &std::cerr);
+  std::vector<Clock::time_point> due(nTimers);
+  std::vector<Clock::time_point> started(nTimers);
+  std::vector<TimerHandle> handles(nTimers);
+  std::atomic<size_t> fired(0);
+  // Leave time to add them all before the first is due
+  const Clock::time_point now = Clock::now() + std::chrono::milliseconds(500);
+  auto start = Clock::now();
+  for (size_t i = 0; i < nTimers; i++) {
+    due[i] = now + delays[i];
+    handles[i] = pool.addTaskAt(due[i], [&started, &fired, i]() {
+      started[i] = Clock::now();
+      ++fired;
+    });
+  }
+  const double addNs = nsPer(start, nTimers);
+  start = Clock::now();
+  size_t cancelled = 0;
+  for (size_t i = 0; i < nTimers; i += 2)
+    cancelled += handles[i].cancel();
+  const double cancelNs = nsPer(start, (nTimers + 1) / 2);
+  std::cout << "ThreadPool\tadd " << addNs << " ns\tcancel " << cancelNs << " ns\n";
+
+  while (pool.pendingTimers() > 0)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  pool.waitUntilComplete();
+
+  LatencyHistogram lateness;
+  for (size_t i = 1; i < nTimers; i += 2) {
+    lateness.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        started[i] - due[i]).count());
+  }
+  std::cout << "Lateness\tp50 " << lateness.percentile(50) / 1000.0 << " us"
+            << "\tp99 " << lateness.percentile(99) / 1000.0 << " us"
+            << "\tmax " << lateness.max() / 1000.0 << " us\n";
+  if (fired + cancelled != nTimers) {
+    std::cerr << "FAILED: " << fired << " timers fired and " << cancelled
+              << " were cancelled, out of " << nTimers << "\n";
+    return 1;
+  }
+  return 0;
+}
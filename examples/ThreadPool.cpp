@@ -6,6 +6,8 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <mutex>
 #include <thread>
@@ -59,4 +61,81 @@ int main(int argc, char **argv) {
   std::this_thread::sleep_for(std::chrono::milliseconds(50));
   pool.waitUntilComplete(false, // We don't want other threads to add new tasks while we're waiting
                          true); // We want the thread pool to be unusable afterwards
-}
\ No newline at end of file
+
+  //
+  // Third example - only wait for our own tasks using a TaskGroup
+  //
+  std::cout << "\n"
+               "================================================\n"
+               "ThreadPool example 3 : wait for a group of tasks\n"
+               "================================================\n";
+  {
+    helper::TaskGroup group(pool);
+    for (int i=0 ; i<=10 ; i+=1) {
+      group.addTask([i, &mt]() {
+        uint64_t res = fib(2 * i);
+        std::lock_guard<std::mutex> guard(mt);
+        std::cout << "fib(" << 2 * i << ") : " << res << "\n";
+      });
+    }
+    group.wait();  // Returns as soon as the group's last task finishes
+  }
+
+  //
+  // Fourth example - let urgent tasks jump ahead of background tasks
+  //
+  std::cout << "\n"
+               "===============================================\n"
+               "ThreadPool example 4 : priority levels [fib(n)]\n"
+               "===============================================\n";
+  {
+    helper::ThreadPoolOptions options;
+    options.nThreads        = 1;
+    options.priorityLevels  = 2;  // 0 for urgent tasks, 1 for background tasks
+    options.defaultPriority = 1;
+    helper::ThreadPool priorityPool(options, &std::cerr);
+    for (int i=0 ; i<5 ; i+=1) {
+      priorityPool.addTask([i, &mt]() {
+        uint64_t res = fib(i);
+        std::lock_guard<std::mutex> guard(mt);
+        std::cout << "background fib(" << i << ") : " << res << "\n";
+      });
+    }
+    for (int i=0 ; i<5 ; i+=1) {
+      priorityPool.addTask([i, &mt]() {
+        uint64_t res = fib(i);
+        std::lock_guard<std::mutex> guard(mt);
+        std::cout << "urgent fib(" << i << ") : " << res << "\n";
+      }, 0);
+    }
+    priorityPool.waitUntilComplete();  // Urgent tasks run before the waiting background tasks
+  }
+
+  //
+  // Fifth example - delayed and periodic tasks, without a worker sleeping in each
+  //
+  std::cout << "\n"
+               "=================================================\n"
+               "ThreadPool example 5 : timers [fib(n) every 10ms]\n"
+               "=================================================\n";
+  {
+    helper::ThreadPool timerPool(2, &std::cerr);
+    std::atomic<int> n(0);
+    helper::TimerHandle ticker = timerPool.addPeriodicTask(std::chrono::milliseconds(10), [&n, &mt]() {
+      int i = n++;
+      uint64_t res = fib(i);
+      std::lock_guard<std::mutex> guard(mt);
+      std::cout << "fib(" << i << ") : " << res << "\n";
+    });
+    timerPool.addTaskAfter(std::chrono::milliseconds(55), [&ticker]() {
+      ticker.cancel();  // Stop after five or so runs
+    });
+    helper::TimerHandle never = timerPool.addTaskAfter(std::chrono::seconds(1), [&mt]() {
+      std::lock_guard<std::mutex> guard(mt);
+      std::cout << "This never runs\n";
+    });
+    never.cancel();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    timerPool.waitUntilComplete();
+  }
+}
@@ -7,7 +7,20 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
 #include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace helper {
 namespace optional {
@@ -20,6 +33,64 @@ namespace optional {
 ////////////////////////////////////////////////////////////////////////////////
 class ConstructFromParameterList {};
 
+template <typename T>
+class ObjectPool;
+
+////////////////////////////////////////////////////////////////////////////////
+// OptionalDeleter<T>
+//   Creates and destroys the T managed by an Optional<T>, using either new and
+//   delete, or a std::pmr::memory_resource (e.g. an arena that lives as long as
+//   a request) when one is given. A T lent out by an ObjectPool is given back
+//   to the pool rather than destroyed.
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class OptionalDeleter {
+public:
+  explicit OptionalDeleter(std::pmr::memory_resource* resource = nullptr,
+                           ObjectPool<T>* pool = nullptr)
+  : resource_(resource), pool_(pool) {}
+
+  // The resource the T is allocated from, or nullptr for new/delete
+  std::pmr::memory_resource* resource() const { return resource_; }
+
+  template <typename... Args>
+  T* create(Args&&... args) const {
+    void* memory = allocate();
+    try {
+      return ::new (memory) T(std::forward<Args>(args)...);
+    } catch (...) {
+      deallocate(memory);
+      throw;
+    }
+  }
+
+  void operator()(T* t) const {
+    if (pool_) {
+      pool_->recycle(t);
+      return;
+    }
+    t->~T();
+    deallocate(t);
+  }
+
+  void* allocate() const {
+    if (resource_)
+      return resource_->allocate(sizeof(T), alignof(T));
+    return std::allocator<T>().allocate(1);
+  }
+
+  void deallocate(void* memory) const {
+    if (resource_)
+      resource_->deallocate(memory, sizeof(T), alignof(T));
+    else
+      std::allocator<T>().deallocate(static_cast<T*>(memory), 1);
+  }
+
+private:
+  std::pmr::memory_resource* resource_;
+  ObjectPool<T>*             pool_;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Optional<T>
 //   Defines a class that potentially owns an instance of T. This should not be
@@ -27,47 +98,83 @@ class ConstructFromParameterList {};
 //   copy CTORs to be applied to the managed data item.
 //
 //   Note that any instances of T are managed using smart pointers, and
-//   therefore live on the heap. It might be worth trying to avoid using
-//   Copyable/NonCopyable to manage large data structures
+//   therefore live on the heap (or in the memory_resource they were allocated
+//   from). It might be worth trying to avoid using Copyable/NonCopyable to
+//   manage large data structures, and for small types InlineCopyable and
+//   InlineNonCopyable avoid the allocation altogether
 ////////////////////////////////////////////////////////////////////////////////
 template <typename T>
 class Optional {
 public:
   // Basic operators
-  operator bool() const { return static_cast<bool>(t_); }
-  T* operator->()       { return t_.get(); }
-  T& operator*()        { return *(t_.get()); }
-  void release()        { t_.release(); }
+  operator bool() const          { return static_cast<bool>(t_); }
+  T* operator->()                { return t_.get(); }
+  const T* operator->() const    { return t_.get(); }
+  T& operator*()                 { return *(t_.get()); }
+  const T& operator*() const     { return *(t_.get()); }
+  void release()                 { t_.release(); }
+
+  // Destroys the managed T (if any)
+  void reset()                   { t_.reset(); }
+
+  // Replaces the managed T (if any) with one constructed from args. The memory
+  // of the old T is reused, so args must not refer to it
+  template <typename... Args>
+  T& emplace(Args&&... args) {
+    if (!t_) {
+      t_.reset(t_.get_deleter().create(std::forward<Args>(args)...));
+      return *t_;
+    }
+    T* t = t_.release();
+    t->~T();
+    try {
+      ::new (static_cast<void*>(t)) T(std::forward<Args>(args)...);
+    } catch (...) {
+      t_.get_deleter().deallocate(t);
+      throw;
+    }
+    t_.reset(t);
+    return *t;
+  }
 
 protected:
-  // CTOR - Create a Optional<T> constructing T from an argument list
+  using Pointer = std::unique_ptr<T, OptionalDeleter<T>>;
+
+  // CTOR - Create a Optional<T> constructing T from an argument list, in memory
+  // from resource (or new, if resource is nullptr)
   template <typename... Args>
-  explicit Optional(const ConstructFromParameterList&, Args... args)
-  : t_(std::make_unique<T>(args...)) {}
+  explicit Optional(const ConstructFromParameterList&, std::pmr::memory_resource* resource,
+                    Args&&... args)
+  : t_(OptionalDeleter<T>(resource).create(std::forward<Args>(args)...),
+       OptionalDeleter<T>(resource)) {}
 
   // Default CTOR - Create a Optional<T> that doesn't own a T
   explicit Optional()
   : t_() {}
 
   // Move CTOR
-  explicit Optional(std::unique_ptr<T> t)
+  explicit Optional(Pointer t)
   : t_(std::move(t)) {}
 
   // The managed resource
-  std::unique_ptr<T> t_;
+  Pointer t_;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
 // Copyable<T>
 //   Defines a class that potentially owns an instance of T. Copies of Copyable
 //   objects makes copies of any managed T instances, so this class should be
-//   used sparingly.
+//   used sparingly. Copies are always made with new, even if the original was
+//   allocated from a memory_resource.
 ////////////////////////////////////////////////////////////////////////////////
 template <typename T>
 class Copyable : public Optional<T> {
 public:
   template <typename U, typename... Args>
-  friend Copyable<U> make_copyable(Args... args);
+  friend Copyable<U> make_copyable(Args&&... args);
+  template <typename U, typename... Args>
+  friend Copyable<U> allocate_copyable(std::pmr::polymorphic_allocator<std::byte> alloc,
+                                       Args&&... args);
 
   // Default CTOR - Create a Copyable<T> that doesn't own a T
   Copyable()
@@ -75,10 +182,15 @@ public:
 
   // Copy CTORS -  These create copies of the managed resource (if any)
   Copyable(const Copyable& other)
-  : Optional<T>(std::make_unique<T>(*(other.t_))) {}
+  : Optional<T>() {
+    if (other.t_)
+      Optional<T>::t_.reset(Optional<T>::t_.get_deleter().create(*(other.t_)));
+  }
 
   Copyable<T>& operator=(const Copyable<T>& other) {
-    Optional<T>::t_ = std::make_unique<T>(*(other.t_));
+    const OptionalDeleter<T>& deleter = Optional<T>::t_.get_deleter();
+    Optional<T>::t_ = typename Optional<T>::Pointer(
+        other.t_ ? deleter.create(*(other.t_)) : nullptr, deleter);
     return *this;
   }
 
@@ -89,17 +201,30 @@ public:
 protected:
   // CTOR of Optional constructing a T from an argument list
   template <typename... Args>
-  explicit Copyable(const ConstructFromParameterList& flag, Args... args)
-  : Optional<T>(flag, args...) {}
+  explicit Copyable(const ConstructFromParameterList& flag, std::pmr::memory_resource* resource,
+                    Args&&... args)
+  : Optional<T>(flag, resource, std::forward<Args>(args)...) {}
 };
 
 ////////////////////////////////////////////////////////////////////////////////
-// makeCopyable<T>(Args... args)
+// makeCopyable<T>(Args&&... args)
 //   A helper function for creating Copyable<T> instances
 ////////////////////////////////////////////////////////////////////////////////
 template <typename T, typename... Args>
-Copyable<T> make_copyable(Args... args) {
-  return Copyable<T>::Copyable(ConstructFromParameterList(), args...);
+Copyable<T> make_copyable(Args&&... args) {
+  return Copyable<T>(ConstructFromParameterList(), nullptr, std::forward<Args>(args)...);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// allocate_copyable<T>(alloc, Args&&... args)
+//   As make_copyable, but allocating the T from a std::pmr::memory_resource
+//   (or a polymorphic_allocator using one), which must outlive the Copyable
+////////////////////////////////////////////////////////////////////////////////
+template <typename T, typename... Args>
+Copyable<T> allocate_copyable(std::pmr::polymorphic_allocator<std::byte> alloc,
+                              Args&&... args) {
+  return Copyable<T>(ConstructFromParameterList(), alloc.resource(),
+                     std::forward<Args>(args)...);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -119,7 +244,11 @@ template <typename T>
 class NonCopyable : public Optional<T> {
 public:
   template <typename U, typename... Args>
-  friend NonCopyable<U> make_noncopyable(Args... args);
+  friend NonCopyable<U> make_noncopyable(Args&&... args);
+  friend class ObjectPool<T>;
+  template <typename U, typename... Args>
+  friend NonCopyable<U> allocate_noncopyable(std::pmr::polymorphic_allocator<std::byte> alloc,
+                                             Args&&... args);
 
   // Default CTOR - Create a NonCopyable<T> that doesn't own a T
   NonCopyable()
@@ -131,7 +260,7 @@ public:
   : Optional<T>() {}
 
   NonCopyable<T>& operator=(const NonCopyable<T>& o) {
-    Optional<T>::t_.release();
+    Optional<T>::t_.reset();
     return *this;
   }
 
@@ -142,14 +271,1110 @@ public:
 protected:
   // CTOR of Optional constructing a T from an argument list
   template <typename... Args>
-  explicit NonCopyable(const ConstructFromParameterList& flag, Args... args)
-  : Optional<T>(flag, args...) {}
+  explicit NonCopyable(const ConstructFromParameterList& flag,
+                       std::pmr::memory_resource* resource, Args&&... args)
+  : Optional<T>(flag, resource, std::forward<Args>(args)...) {}
+
+  // CTOR taking ownership of a T (e.g. one lent out by an ObjectPool)
+  explicit NonCopyable(typename Optional<T>::Pointer t)
+  : Optional<T>(std::move(t)) {}
 };
 
 template <typename T, typename... Args>
-NonCopyable<T> make_noncopyable(Args... args) {
-  return NonCopyable<T>::NonCopyable(ConstructFromParameterList(), args...);
+NonCopyable<T> make_noncopyable(Args&&... args) {
+  return NonCopyable<T>(ConstructFromParameterList(), nullptr, std::forward<Args>(args)...);
+}
+
+template <typename T, typename... Args>
+NonCopyable<T> allocate_noncopyable(std::pmr::polymorphic_allocator<std::byte> alloc,
+                                    Args&&... args) {
+  return NonCopyable<T>(ConstructFromParameterList(), alloc.resource(),
+                        std::forward<Args>(args)...);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// ObjectPool<T>
+//   Lends out NonCopyable<T>s, and takes the T back when the NonCopyable is
+//   destroyed, reset or copied onto, so that expensive objects (e.g. streams
+//   or buffers) are reused rather than constructed and destroyed each time.
+//   The optional reset hook is run on each T as it comes back, e.g. to clear
+//   a std::ostringstream, and if it throws the T is destroyed instead.
+//
+//   Each thread keeps up to 2 * cacheSize idle objects of its own, and hands
+//   them between threads through a shared list (of at most maxIdle objects) in
+//   batches of cacheSize, so lending and taking back on one thread doesn't
+//   lock. The pool must outlive the NonCopyables it lends.
+//
+//   Usage:
+//       ObjectPool<std::ostringstream> logs([](std::ostringstream& s) { s.str(""); });
+//       thread_pool.addTask([&logs]() {
+//         NonCopyable<std::ostringstream> log = logs.acquire();
+//         *log << "...";
+//       });
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class ObjectPool {
+public:
+  explicit ObjectPool(std::function<void(T&)> reset = nullptr, size_t cacheSize = 16,
+                      size_t maxIdle = 1024)
+  : shared_(std::make_shared<Shared>(std::move(reset), std::max<size_t>(1, cacheSize),
+                                     maxIdle)) {}
+
+  ObjectPool(const ObjectPool&) = delete;
+  ObjectPool& operator=(const ObjectPool&) = delete;
+
+  // Destroys the idle objects. Any cached by other threads are destroyed when
+  // those threads next run out of cached objects in (or first use) any
+  // ObjectPool<T>, or exit
+  ~ObjectPool() {
+    std::vector<T*> idle;
+    {
+      std::lock_guard<std::mutex> guard(shared_->mt);
+      shared_->closed = true;
+      idle.swap(shared_->idle);
+    }
+    destroy(idle);
+    if (Caches* caches = threadCaches())
+      caches->remove(shared_.get());
+  }
+
+  // Lends out an idle T, or if there are none constructs one from args
+  template <typename... Args>
+  NonCopyable<T> acquire(Args&&... args) {
+    T* t = take();
+    if (!t) {
+      t = OptionalDeleter<T>().create(std::forward<Args>(args)...);
+      shared_->created.fetch_add(1, std::memory_order_relaxed);
+    }
+    return NonCopyable<T>(typename Optional<T>::Pointer(t, OptionalDeleter<T>(nullptr, this)));
+  }
+
+  // The number of T the pool has constructed
+  size_t created() const { return shared_->created.load(std::memory_order_relaxed); }
+
+private:
+  friend class OptionalDeleter<T>;
+
+  struct Shared {
+    Shared(std::function<void(T&)> r, size_t c, size_t m)
+    : reset(std::move(r)), cacheSize(c), maxIdle(m) {}
+
+    const std::function<void(T&)> reset;
+    const size_t                  cacheSize;
+    const size_t                  maxIdle;
+    std::atomic<size_t>           created{ 0 };
+    std::mutex                    mt;
+    std::vector<T*>               idle;    // Guarded by mt
+    bool                          closed = false;
+  };
+
+  // A thread's idle objects from one pool
+  struct Cache {
+    std::shared_ptr<Shared> shared;
+    std::vector<T*>         idle;
+  };
+
+  // A thread's caches, for each pool of T it has used
+  struct Caches {
+    std::vector<Cache> caches;
+
+    Cache& find(const std::shared_ptr<Shared>& shared) {
+      for (Cache& cache : caches) {
+        if (cache.shared == shared)
+          return cache;
+      }
+      pruneClosed();
+      caches.push_back(Cache{ shared, {} });
+      return caches.back();
+    }
+
+    // Drops the caches of pools that have gone
+    void pruneClosed() {
+      for (size_t i = caches.size(); i-- > 0;) {
+        bool closed;
+        {
+          std::lock_guard<std::mutex> guard(caches[i].shared->mt);
+          closed = caches[i].shared->closed;
+        }
+        if (closed)
+          remove(caches[i].shared.get());
+      }
+    }
+
+    void remove(Shared* shared) {
+      for (size_t i = 0; i < caches.size(); i++) {
+        if (caches[i].shared.get() == shared) {
+          destroy(caches[i].idle);
+          caches.erase(caches.begin() + i);
+          return;
+        }
+      }
+    }
+
+    ~Caches() {
+      for (Cache& cache : caches)
+        giveBack(*cache.shared, cache.idle, cache.idle.size());
+    }
+  };
+
+  // This thread's caches, or nullptr once they've been destroyed at thread exit
+  static Caches* threadCaches() {
+    struct Holder {
+      Caches caches;
+      bool& alive;
+      explicit Holder(bool& a) : alive(a) { alive = true; }
+      ~Holder() { alive = false; }
+    };
+    thread_local bool alive = false;
+    thread_local Holder holder(alive);
+    return alive ? &holder.caches : nullptr;
+  }
+
+  static void destroy(std::vector<T*>& objects) {
+    OptionalDeleter<T> deleter;
+    for (T* t : objects)
+      deleter(t);
+    objects.clear();
+  }
+
+  // Moves the last n objects of idle to the shared list, destroying any that
+  // don't fit (or all of them, if the pool has gone)
+  static void giveBack(Shared& shared, std::vector<T*>& idle, size_t n) noexcept {
+    const size_t first = idle.size() - n;
+    size_t kept = 0;
+    {
+      std::lock_guard<std::mutex> guard(shared.mt);
+      if (!shared.closed && shared.idle.size() < shared.maxIdle) {
+        kept = std::min(n, shared.maxIdle - shared.idle.size());
+        try {
+          shared.idle.insert(shared.idle.end(), idle.begin() + first, idle.begin() + first + kept);
+        } catch (...) {
+          kept = 0;
+        }
+      }
+    }
+    OptionalDeleter<T> deleter;
+    for (size_t i = first + kept; i < idle.size(); i++)
+      deleter(idle[i]);
+    idle.resize(first);
+  }
+
+  // An idle T from this thread's cache, or a batch from the shared list
+  T* take() {
+    Caches* caches = threadCaches();
+    if (!caches) {
+      std::lock_guard<std::mutex> guard(shared_->mt);
+      if (shared_->idle.empty())
+        return nullptr;
+      T* t = shared_->idle.back();
+      shared_->idle.pop_back();
+      return t;
+    }
+    Cache* found = &caches->find(shared_);
+    if (found->idle.empty()) {
+      // We're going to lock anyway, so it's a good time to free what pools
+      // that have gone left in this thread's caches
+      caches->pruneClosed();
+      found = &caches->find(shared_);
+    }
+    Cache& cache = *found;
+    if (cache.idle.empty()) {
+      std::lock_guard<std::mutex> guard(shared_->mt);
+      const size_t n = std::min(shared_->cacheSize, shared_->idle.size());
+      cache.idle.insert(cache.idle.end(), shared_->idle.end() - n, shared_->idle.end());
+      shared_->idle.resize(shared_->idle.size() - n);
+    }
+    if (cache.idle.empty())
+      return nullptr;
+    T* t = cache.idle.back();
+    cache.idle.pop_back();
+    return t;
+  }
+
+  // Takes back a T that was lent out
+  void recycle(T* t) noexcept {
+    if (shared_->reset) {
+      try {
+        shared_->reset(*t);
+      } catch (...) {
+        OptionalDeleter<T>()(t);
+        return;
+      }
+    }
+    Caches* caches = threadCaches();
+    if (caches) {
+      try {
+        Cache& cache = caches->find(shared_);
+        cache.idle.push_back(t);
+        if (cache.idle.size() >= 2 * shared_->cacheSize)
+          giveBack(*shared_, cache.idle, shared_->cacheSize);
+        return;
+      } catch (...) {
+        // Out of memory for the cache - fall back to the shared list
+      }
+    }
+    {
+      std::lock_guard<std::mutex> guard(shared_->mt);
+      if (!shared_->closed && shared_->idle.size() < shared_->maxIdle) {
+        try {
+          shared_->idle.push_back(t);
+          return;
+        } catch (...) {}
+      }
+    }
+    OptionalDeleter<T>()(t);
+  }
+
+  std::shared_ptr<Shared> shared_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// CowCopyable<T>
+//   A Copyable<T> that copies on write. Copies share the T (with an atomic
+//   reference count), and the T is only copied when it is shared and accessed
+//   through the non-const operator-> or operator*. Const access never copies,
+//   so this suits large, mostly read-only objects that are copied a lot - e.g.
+//   configuration captured by every task added to a ThreadPool, and read from
+//   the (const) captures of the task lambdas.
+//
+//   As with std::shared_ptr, different CowCopyables sharing a T can be used
+//   (and written to) from different threads at once, but one CowCopyable can't
+//   be. A reference from non-const access shouldn't be kept after copying the
+//   CowCopyable, as the copy would see writes through it.
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class CowCopyable {
+public:
+  template <typename U, typename... Args>
+  friend CowCopyable<U> make_cow_copyable(Args&&... args);
+
+  // Default CTOR - Create a CowCopyable<T> that doesn't own a T
+  CowCopyable()
+  : block_(nullptr) {}
+
+  // Copy CTORS - These share the managed resource (if any)
+  CowCopyable(const CowCopyable& other) noexcept
+  : block_(other.block_) {
+    if (block_)
+      block_->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  CowCopyable<T>& operator=(const CowCopyable<T>& other) noexcept {
+    if (block_ != other.block_) {
+      if (other.block_)
+        other.block_->refs.fetch_add(1, std::memory_order_relaxed);
+      reset();
+      block_ = other.block_;
+    }
+    return *this;
+  }
+
+  // Move CTORs - These work as expected
+  CowCopyable(CowCopyable&& other) noexcept
+  : block_(other.block_) {
+    other.block_ = nullptr;
+  }
+
+  CowCopyable<T>& operator=(CowCopyable<T>&& other) noexcept {
+    if (this != &other) {
+      reset();
+      block_ = other.block_;
+      other.block_ = nullptr;
+    }
+    return *this;
+  }
+
+  ~CowCopyable() { reset(); }
+
+  // Basic operators. The non-const ones copy the T if it is shared
+  operator bool() const            { return block_ != nullptr; }
+  const T* operator->() const      { return block_ ? &(block_->t) : nullptr; }
+  const T& operator*() const       { return block_->t; }
+  T* operator->()                  { return block_ ? &(unshare().t) : nullptr; }
+  T& operator*()                   { return unshare().t; }
+
+  // Whether the T is shared with other copies (so writing to it would copy it)
+  bool shared() const {
+    return block_ && block_->refs.load(std::memory_order_acquire) > 1;
+  }
+
+  // Destroys the managed T, if this is the last copy sharing it
+  void reset() {
+    if (block_ && block_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      delete block_;
+    block_ = nullptr;
+  }
+
+  // Replaces the managed T (if any) with one constructed from args. Other
+  // copies sharing the old T keep it
+  template <typename... Args>
+  T& emplace(Args&&... args) {
+    Block* block = new Block(std::forward<Args>(args)...);
+    reset();
+    block_ = block;
+    return block_->t;
+  }
+
+private:
+  // The shared T, and the number of CowCopyables sharing it
+  struct Block {
+    template <typename... Args>
+    explicit Block(Args&&... args)
+    : refs(1), t(std::forward<Args>(args)...) {}
+
+    std::atomic<size_t> refs;
+    T                   t;
+  };
+
+  explicit CowCopyable(Block* block)
+  : block_(block) {}
+
+  // Makes sure that we are the only copy using the T, copying it if not. The
+  // acquire load (paired with the release in other copies' reset) makes their
+  // reads of the T happen before our writes to it
+  Block& unshare() {
+    if (block_->refs.load(std::memory_order_acquire) != 1) {
+      Block* copy = new Block(block_->t);
+      reset();
+      block_ = copy;
+    }
+    return *block_;
+  }
+
+  Block* block_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// make_cow_copyable<T>(Args&&... args)
+//   A helper function for creating CowCopyable<T> instances
+////////////////////////////////////////////////////////////////////////////////
+template <typename T, typename... Args>
+CowCopyable<T> make_cow_copyable(Args&&... args) {
+  return CowCopyable<T>(new typename CowCopyable<T>::Block(std::forward<Args>(args)...));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// CopyablePolicy, NonCopyablePolicy
+//   The copy semantics of an OptionalArray: with CopyablePolicy copies copy
+//   every value (as Copyable does), and with NonCopyablePolicy copies are empty
+//   and copying onto an array empties it (as NonCopyable does).
+////////////////////////////////////////////////////////////////////////////////
+struct CopyablePolicy    { static constexpr bool copyValues = true; };
+struct NonCopyablePolicy { static constexpr bool copyValues = false; };
+
+////////////////////////////////////////////////////////////////////////////////
+// OptionalArray<T, Policy>
+//   A fixed number of slots that each might hold a T - like a
+//   std::vector<Copyable<T>>, but with the values stored contiguously (rather
+//   than each in its own allocation) and a bitmap saying which slots hold one.
+//   Iterators only visit the slots holding a value, skipping empty ones 64 at
+//   a time, and count()/any() work on whole words of the bitmap.
+//
+//   For example, to sum the values that exist:
+//       OptionalArray<double> values(1000);
+//       values.emplace(7, 1.5);
+//       for (double v : values)
+//         total += v;
+//   (use it.index() to find which slot an iterator is at).
+////////////////////////////////////////////////////////////////////////////////
+template <typename T, typename Policy = CopyablePolicy>
+class OptionalArray {
+  template <bool Const> class Iterator;
+
+public:
+  using iterator       = Iterator<false>;
+  using const_iterator = Iterator<true>;
+
+  // CTOR - Create an OptionalArray with size empty slots
+  explicit OptionalArray(size_t size = 0)
+  : size_(size), values_(size ? std::allocator<T>().allocate(size) : nullptr),
+    bits_(wordCount(size), 0) {}
+
+  // Copy CTORs - These copy the values if Policy::copyValues, and otherwise
+  // give an array of the same size with every slot empty
+  OptionalArray(const OptionalArray& other)
+  : OptionalArray(other.size_) {
+    if constexpr (Policy::copyValues)
+      copyFrom(other);
+  }
+
+  OptionalArray& operator=(const OptionalArray& other) {
+    if (this == &other)
+      return *this;
+    clear();
+    if constexpr (Policy::copyValues) {
+      if (size_ != other.size_)
+        OptionalArray(other.size_).swap(*this);
+      copyFrom(other);
+    }
+    return *this;
+  }
+
+  // Move CTORs - These work as expected
+  OptionalArray(OptionalArray&& other) noexcept
+  : size_(other.size_), values_(other.values_), bits_(std::move(other.bits_)) {
+    other.size_   = 0;
+    other.values_ = nullptr;
+    other.bits_.clear();
+  }
+
+  OptionalArray& operator=(OptionalArray&& other) noexcept {
+    OptionalArray(std::move(other)).swap(*this);
+    return *this;
+  }
+
+  ~OptionalArray() {
+    clear();
+    if (values_)
+      std::allocator<T>().deallocate(values_, size_);
+  }
+
+  void swap(OptionalArray& other) noexcept {
+    std::swap(size_, other.size_);
+    std::swap(values_, other.values_);
+    bits_.swap(other.bits_);
+  }
+
+  // The number of slots
+  size_t size() const { return size_; }
+
+  // Whether slot i holds a value
+  bool has(size_t i) const { return (bits_[i / 64] >> (i % 64)) & 1; }
+
+  // The value in slot i, which must hold one
+  T& operator[](size_t i)             { return values_[i]; }
+  const T& operator[](size_t i) const { return values_[i]; }
+
+  // The value in slot i, or nullptr if it doesn't hold one
+  T* get(size_t i)             { return has(i) ? values_ + i : nullptr; }
+  const T* get(size_t i) const { return has(i) ? values_ + i : nullptr; }
+
+  // Replaces the value in slot i (if any) with one constructed from args
+  template <typename... Args>
+  T& emplace(size_t i, Args&&... args) {
+    reset(i);
+    ::new (static_cast<void*>(values_ + i)) T(std::forward<Args>(args)...);
+    bits_[i / 64] |= uint64_t(1) << (i % 64);
+    return values_[i];
+  }
+
+  // Destroys the value in slot i (if any)
+  void reset(size_t i) {
+    if (has(i)) {
+      values_[i].~T();
+      bits_[i / 64] &= ~(uint64_t(1) << (i % 64));
+    }
+  }
+
+  // The number of slots holding a value
+  size_t count() const {
+    size_t n = 0;
+    for (uint64_t word : bits_)
+      n += popCount(word);
+    return n;
+  }
+
+  // Whether any slot holds a value
+  bool any() const {
+    uint64_t any = 0;
+    for (uint64_t word : bits_)
+      any |= word;
+    return any != 0;
+  }
+
+  // Puts a copy of value in every slot, assigning to the existing values
+  void fill(const T& value) {
+    for (size_t w = 0; w < bits_.size(); w++) {
+      const size_t first = w * 64, last = std::min(size_, first + 64);
+      for (size_t i = first; i < last; i++) {
+        if ((bits_[w] >> (i - first)) & 1)
+          values_[i] = value;
+        else
+          ::new (static_cast<void*>(values_ + i)) T(value);
+        bits_[w] |= uint64_t(1) << (i - first);
+      }
+    }
+  }
+
+  // Destroys every value. For trivially destructible types this only has to
+  // clear the bitmap
+  void clear() {
+    if (!std::is_trivially_destructible<T>::value) {
+      for (T& value : *this)
+        value.~T();
+    }
+    std::fill(bits_.begin(), bits_.end(), 0);
+  }
+
+  // Iterators over the slots holding a value
+  iterator begin()             { return iterator(this, 0); }
+  iterator end()               { return iterator(this, bits_.size()); }
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const   { return const_iterator(this, bits_.size()); }
+
+private:
+  static size_t wordCount(size_t size) { return (size + 63) / 64; }
+
+  static size_t popCount(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<size_t>(__builtin_popcountll(x));
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ull);
+    x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return static_cast<size_t>((x * 0x0101010101010101ull) >> 56);
+#endif
+  }
+
+  // The index of the lowest set bit of x, which mustn't be 0
+  static size_t countTrailingZeros(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<size_t>(__builtin_ctzll(x));
+#else
+    return popCount((x & (~x + 1)) - 1);
+#endif
+  }
+
+  // Copies other's values into this (empty) array of the same size
+  void copyFrom(const OptionalArray& other) {
+    if constexpr (std::is_trivially_copyable<T>::value) {
+      if (size_)
+        std::memcpy(static_cast<void*>(values_), other.values_, size_ * sizeof(T));
+      bits_ = other.bits_;
+    } else {
+      for (auto it = other.begin(); it != other.end(); ++it)
+        emplace(it.index(), *it);
+    }
+  }
+
+  // Visits the set bits of the bitmap, a word at a time
+  template <bool Const>
+  class Iterator {
+  public:
+    using Array             = typename std::conditional<Const, const OptionalArray, OptionalArray>::type;
+    using iterator_category = std::forward_iterator_tag;
+    using value_type        = T;
+    using difference_type   = std::ptrdiff_t;
+    using pointer           = typename std::conditional<Const, const T*, T*>::type;
+    using reference         = typename std::conditional<Const, const T&, T&>::type;
+
+    Iterator()
+    : array_(nullptr), word_(0), bits_(0) {}
+
+    Iterator(Array* array, size_t word)
+    : array_(array), word_(word),
+      bits_(word < array->bits_.size() ? array->bits_[word] : 0) {
+      skipEmptyWords();
+    }
+
+    // The slot we're at
+    size_t index() const { return word_ * 64 + countTrailingZeros(bits_); }
+
+    reference operator*() const { return array_->values_[index()]; }
+    pointer operator->() const  { return array_->values_ + index(); }
+
+    Iterator& operator++() {
+      bits_ &= bits_ - 1;  // Clear the lowest set bit
+      skipEmptyWords();
+      return *this;
+    }
+
+    Iterator operator++(int) {
+      Iterator it = *this;
+      ++(*this);
+      return it;
+    }
+
+    bool operator==(const Iterator& other) const {
+      return word_ == other.word_ && bits_ == other.bits_;
+    }
+    bool operator!=(const Iterator& other) const { return !(*this == other); }
+
+  private:
+    void skipEmptyWords() {
+      const size_t nWords = array_->bits_.size();
+      while (bits_ == 0 && word_ < nWords) {
+        if (++word_ < nWords)
+          bits_ = array_->bits_[word_];
+      }
+    }
+
+    Array*   array_;
+    size_t   word_;  // The bitmap word we're in
+    uint64_t bits_;  // The bits of that word we haven't visited yet
+  };
+
+  size_t                size_;
+  T*                    values_;
+  std::vector<uint64_t> bits_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// InlineStorage<T>
+//   Space for a T inside the object, and a flag saying whether it holds one.
+//   This is the storage behind InlineOptional<T>, and is specialised on whether
+//   T is trivially destructible so that it can be too.
+////////////////////////////////////////////////////////////////////////////////
+template <typename T, bool = std::is_trivially_destructible<T>::value>
+class InlineStorage {
+protected:
+  constexpr InlineStorage() noexcept
+  : empty_(), engaged_(false) {}
+
+  template <typename... Args>
+  constexpr explicit InlineStorage(const ConstructFromParameterList&, Args&&... args)
+  : t_(std::forward<Args>(args)...), engaged_(true) {}
+
+  void destroy() noexcept { engaged_ = false; }
+
+  union {
+    char empty_;
+    T    t_;
+  };
+  bool engaged_;
+};
+
+template <typename T>
+class InlineStorage<T, false> {
+protected:
+  constexpr InlineStorage() noexcept
+  : empty_(), engaged_(false) {}
+
+  template <typename... Args>
+  constexpr explicit InlineStorage(const ConstructFromParameterList&, Args&&... args)
+  : t_(std::forward<Args>(args)...), engaged_(true) {}
+
+  ~InlineStorage() { destroy(); }
+
+  void destroy() noexcept {
+    if (engaged_) {
+      t_.~T();
+      engaged_ = false;
+    }
+  }
+
+  union {
+    char empty_;
+    T    t_;
+  };
+  bool engaged_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// InlineOptional<T>
+//   The counterpart of Optional<T> that stores the T inside the object rather
+//   than on the heap, so creating one never allocates and using one never
+//   follows a pointer. As with Optional<T>, this should not be used directly -
+//   use InlineCopyable or InlineNonCopyable.
+//
+//   Unlike Optional<T>, operator-> doesn't return nullptr when there isn't a T,
+//   so check operator bool first. Moving from one of these leaves it holding a
+//   moved-from T (as std::optional does), rather than empty.
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class InlineOptional : public InlineStorage<T> {
+public:
+  // Basic operators
+  constexpr operator bool() const        { return this->engaged_; }
+  constexpr T* operator->()              { return std::addressof(this->t_); }
+  constexpr const T* operator->() const  { return std::addressof(this->t_); }
+  constexpr T& operator*()               { return this->t_; }
+  constexpr const T& operator*() const   { return this->t_; }
+  void release()                         { this->destroy(); }
+  void reset()                           { this->destroy(); }
+
+  // Replaces the T (if any) with one constructed from args, which must not
+  // refer to the old T. If the constructor throws, we are left empty
+  template <typename... Args>
+  T& emplace(Args&&... args) {
+    this->destroy();
+    construct(std::forward<Args>(args)...);
+    return this->t_;
+  }
+
+protected:
+  using InlineStorage<T>::InlineStorage;
+
+  // Constructs a T in the (empty) storage
+  template <typename... Args>
+  void construct(Args&&... args) {
+    ::new (static_cast<void*>(std::addressof(this->t_))) T(std::forward<Args>(args)...);
+    this->engaged_ = true;
+  }
+
+  // Copy or move assignment from another InlineOptional, reusing the T we hold
+  // (if any) rather than destroying it and constructing a new one
+  template <typename Other>
+  void assign(Other&& other) {
+    if (!other.engaged_)
+      this->destroy();
+    else if (this->engaged_)
+      this->t_ = std::forward<Other>(other).t_;
+    else
+      construct(std::forward<Other>(other).t_);
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// InlineCopyableBase<T>
+//   The copy and move operations of InlineCopyable<T>. These are all defaulted
+//   (and so trivial) when T is trivially copyable, and otherwise copy or move
+//   the T we hold.
+////////////////////////////////////////////////////////////////////////////////
+template <typename T, bool = std::is_trivially_copyable<T>::value>
+class InlineCopyableBase : public InlineOptional<T> {
+protected:
+  using InlineOptional<T>::InlineOptional;
+};
+
+template <typename T>
+class InlineCopyableBase<T, false> : public InlineOptional<T> {
+public:
+  InlineCopyableBase(const InlineCopyableBase& other)
+  : InlineOptional<T>() {
+    if (other.engaged_)
+      this->construct(other.t_);
+  }
+
+  InlineCopyableBase(InlineCopyableBase&& other)
+      noexcept(std::is_nothrow_move_constructible<T>::value)
+  : InlineOptional<T>() {
+    if (other.engaged_)
+      this->construct(std::move(other.t_));
+  }
+
+  InlineCopyableBase& operator=(const InlineCopyableBase& other) {
+    this->assign(other);
+    return *this;
+  }
+
+  InlineCopyableBase& operator=(InlineCopyableBase&& other)
+      noexcept(std::is_nothrow_move_constructible<T>::value &&
+               std::is_nothrow_move_assignable<T>::value) {
+    this->assign(std::move(other));
+    return *this;
+  }
+
+protected:
+  using InlineOptional<T>::InlineOptional;
+
+  constexpr InlineCopyableBase() = default;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// InlineCopyable<T>
+//   Copyable<T>, with the T stored inside the object. Copies make copies of
+//   the T (if any), and an InlineCopyable<T> is trivially copyable (and so can
+//   be copied with memcpy, and in constant expressions) whenever T is.
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class InlineCopyable : public InlineCopyableBase<T> {
+public:
+  template <typename U, typename... Args>
+  friend constexpr InlineCopyable<U> make_inline_copyable(Args&&... args);
+
+  // Default CTOR - Create an InlineCopyable<T> that doesn't own a T
+  constexpr InlineCopyable() = default;
+
+protected:
+  // CTOR constructing a T from an argument list
+  template <typename... Args>
+  constexpr explicit InlineCopyable(const ConstructFromParameterList& flag, Args&&... args)
+  : InlineCopyableBase<T>(flag, std::forward<Args>(args)...) {}
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// make_inline_copyable<T>(Args&&... args)
+//   A helper function for creating InlineCopyable<T> instances
+////////////////////////////////////////////////////////////////////////////////
+template <typename T, typename... Args>
+constexpr InlineCopyable<T> make_inline_copyable(Args&&... args) {
+  return InlineCopyable<T>(ConstructFromParameterList(), std::forward<Args>(args)...);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// InlineNonCopyable<T>
+//   NonCopyable<T>, with the T stored inside the object. Copies don't copy the
+//   T, and copying onto an InlineNonCopyable<T> destroys the T it held. As
+//   copies do something other than copy, this is never trivially copyable, but
+//   is trivially destructible whenever T is.
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class InlineNonCopyable : public InlineOptional<T> {
+public:
+  template <typename U, typename... Args>
+  friend constexpr InlineNonCopyable<U> make_inline_noncopyable(Args&&... args);
+
+  // Default CTOR - Create an InlineNonCopyable<T> that doesn't own a T
+  constexpr InlineNonCopyable() = default;
+
+  // Copy CTORS -  These do NOT copy the managed resource, and destroy any
+  // locally-stored copies
+  constexpr InlineNonCopyable(const InlineNonCopyable&) noexcept
+  : InlineOptional<T>() {}
+
+  InlineNonCopyable<T>& operator=(const InlineNonCopyable<T>&) noexcept {
+    this->destroy();
+    return *this;
+  }
+
+  // Move CTORs - These move the T (if any)
+  InlineNonCopyable(InlineNonCopyable&& other)
+      noexcept(std::is_nothrow_move_constructible<T>::value)
+  : InlineOptional<T>() {
+    if (other.engaged_)
+      this->construct(std::move(other.t_));
+  }
+
+  InlineNonCopyable<T>& operator=(InlineNonCopyable<T>&& other)
+      noexcept(std::is_nothrow_move_constructible<T>::value &&
+               std::is_nothrow_move_assignable<T>::value) {
+    this->assign(std::move(other));
+    return *this;
+  }
+
+protected:
+  // CTOR constructing a T from an argument list
+  template <typename... Args>
+  constexpr explicit InlineNonCopyable(const ConstructFromParameterList& flag, Args&&... args)
+  : InlineOptional<T>(flag, std::forward<Args>(args)...) {}
+};
+
+template <typename T, typename... Args>
+constexpr InlineNonCopyable<T> make_inline_noncopyable(Args&&... args) {
+  return InlineNonCopyable<T>(ConstructFromParameterList(), std::forward<Args>(args)...);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// OptionalNiche<T>
+//   Says whether T has a bit pattern that no valid T has (a "niche"), so that
+//   an empty optional can be marked by storing that pattern in place of the T,
+//   with no separate flag. Specialise this for your own trivially copyable
+//   types with value = true, and
+//       static void setEmpty(void* storage);       // Writes the pattern
+//       static bool isEmpty(const void* storage);  // Checks for it
+//   where storage points to sizeof(T) bytes. bool (which only uses 0 and 1)
+//   and std::reference_wrapper (which is never null) are done here.
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+struct OptionalNiche {
+  static constexpr bool value = false;
+};
+
+template <>
+struct OptionalNiche<bool> {
+  static constexpr bool value = true;
+  static void setEmpty(void* storage) { *static_cast<unsigned char*>(storage) = 0xff; }
+  static bool isEmpty(const void* storage) {
+    return *static_cast<const unsigned char*>(storage) == 0xff;
+  }
+};
+
+template <typename U>
+struct OptionalNiche<std::reference_wrapper<U>> {
+  static_assert(sizeof(std::reference_wrapper<U>) == sizeof(U*),
+                "std::reference_wrapper is expected to hold just a pointer");
+  static constexpr bool value = true;
+  static void setEmpty(void* storage) { std::memset(storage, 0, sizeof(U*)); }
+  static bool isEmpty(const void* storage) {
+    U* u;
+    std::memcpy(&u, storage, sizeof(U*));
+    return u == nullptr;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// NicheOptional<T>
+//   The counterpart of InlineOptional<T> for types with an OptionalNiche: the
+//   T is stored inside the object, and an empty one holds the niche pattern
+//   instead, so a NicheOptional<T> is no bigger than a T. As with Optional<T>,
+//   use NicheCopyable or NicheNonCopyable rather than this.
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class NicheOptional {
+  static_assert(OptionalNiche<T>::value, "NicheOptional<T> needs an OptionalNiche<T>");
+  static_assert(std::is_trivially_copyable<T>::value,
+                "NicheOptional<T> needs T to be trivially copyable");
+
+public:
+  // Basic operators
+  operator bool() const          { return !OptionalNiche<T>::isEmpty(std::addressof(t_)); }
+  T* operator->()                { return std::addressof(t_); }
+  const T* operator->() const    { return std::addressof(t_); }
+  T& operator*()                 { return t_; }
+  const T& operator*() const     { return t_; }
+  void release()                 { reset(); }
+  void reset()                   { OptionalNiche<T>::setEmpty(std::addressof(t_)); }
+
+  // Replaces the T (if any) with one constructed from args
+  template <typename... Args>
+  T& emplace(Args&&... args) {
+    ::new (static_cast<void*>(std::addressof(t_))) T(std::forward<Args>(args)...);
+    return t_;
+  }
+
+protected:
+  NicheOptional()
+  : empty_() {
+    reset();
+  }
+
+  template <typename... Args>
+  explicit NicheOptional(const ConstructFromParameterList&, Args&&... args)
+  : t_(std::forward<Args>(args)...) {}
+
+  union {
+    unsigned char empty_;
+    T             t_;
+  };
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// NicheCopyable<T>, NicheNonCopyable<T>
+//   Copyable<T> and NonCopyable<T> for types with an OptionalNiche, stored as
+//   NicheOptional<T>. NicheCopyable<T> is trivially copyable.
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class NicheCopyable : public NicheOptional<T> {
+public:
+  template <typename U, typename... Args>
+  friend NicheCopyable<U> make_niche_copyable(Args&&... args);
+
+  // Default CTOR - Create a NicheCopyable<T> that doesn't own a T
+  NicheCopyable() = default;
+
+protected:
+  // CTOR constructing a T from an argument list
+  template <typename... Args>
+  explicit NicheCopyable(const ConstructFromParameterList& flag, Args&&... args)
+  : NicheOptional<T>(flag, std::forward<Args>(args)...) {}
+};
+
+template <typename T, typename... Args>
+NicheCopyable<T> make_niche_copyable(Args&&... args) {
+  return NicheCopyable<T>(ConstructFromParameterList(), std::forward<Args>(args)...);
+}
+
+template <typename T>
+class NicheNonCopyable : public NicheOptional<T> {
+public:
+  template <typename U, typename... Args>
+  friend NicheNonCopyable<U> make_niche_noncopyable(Args&&... args);
+
+  // Default CTOR - Create a NicheNonCopyable<T> that doesn't own a T
+  NicheNonCopyable() = default;
+
+  // Copy CTORS -  These do NOT copy the managed resource, and invalidates any
+  // locally-stored copies
+  NicheNonCopyable(const NicheNonCopyable&)
+  : NicheOptional<T>() {}
+
+  NicheNonCopyable<T>& operator=(const NicheNonCopyable<T>&) {
+    this->reset();
+    return *this;
+  }
+
+  // Move CTORs - These copy the T, as it is trivially copyable
+  NicheNonCopyable(NicheNonCopyable&& other) = default;
+  NicheNonCopyable<T>& operator=(NicheNonCopyable<T>&& other) = default;
+
+protected:
+  // CTOR constructing a T from an argument list
+  template <typename... Args>
+  explicit NicheNonCopyable(const ConstructFromParameterList& flag, Args&&... args)
+  : NicheOptional<T>(flag, std::forward<Args>(args)...) {}
+};
+
+template <typename T, typename... Args>
+NicheNonCopyable<T> make_niche_noncopyable(Args&&... args) {
+  return NicheNonCopyable<T>(ConstructFromParameterList(), std::forward<Args>(args)...);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// AutoCopyable<T>, AutoNonCopyable<T>
+//   Pick how to store a T at compile time:
+//     Niche  - trivially copyable types no bigger than OptionalInlineLimit<T>
+//              with an OptionalNiche are stored inline, with no flag
+//     Inline - other trivially copyable types no bigger than the limit are
+//              stored inline with a flag (and so are copied with memcpy)
+//     Heap   - everything else is stored on the heap, as Copyable does
+//   The limit defaults to a cache line, and can be changed for a type by
+//   specialising OptionalInlineLimit.
+////////////////////////////////////////////////////////////////////////////////
+enum class OptionalStorageKind { Niche, Inline, Heap };
+
+template <typename T>
+struct OptionalInlineLimit : std::integral_constant<size_t, 64> {};
+
+template <typename T>
+struct OptionalStorageOf {
+  static constexpr OptionalStorageKind value =
+      !std::is_trivially_copyable<T>::value || sizeof(T) > OptionalInlineLimit<T>::value
+          ? OptionalStorageKind::Heap
+          : OptionalNiche<T>::value ? OptionalStorageKind::Niche : OptionalStorageKind::Inline;
+};
+
+template <typename T>
+using AutoCopyable = typename std::conditional<
+    OptionalStorageOf<T>::value == OptionalStorageKind::Niche, NicheCopyable<T>,
+    typename std::conditional<OptionalStorageOf<T>::value == OptionalStorageKind::Inline,
+                              InlineCopyable<T>, Copyable<T>>::type>::type;
+
+template <typename T>
+using AutoNonCopyable = typename std::conditional<
+    OptionalStorageOf<T>::value == OptionalStorageKind::Niche, NicheNonCopyable<T>,
+    typename std::conditional<OptionalStorageOf<T>::value == OptionalStorageKind::Inline,
+                              InlineNonCopyable<T>, NonCopyable<T>>::type>::type;
+
+template <typename T, typename... Args>
+AutoCopyable<T> make_auto_copyable(Args&&... args) {
+  if constexpr (OptionalStorageOf<T>::value == OptionalStorageKind::Niche)
+    return make_niche_copyable<T>(std::forward<Args>(args)...);
+  else if constexpr (OptionalStorageOf<T>::value == OptionalStorageKind::Inline)
+    return make_inline_copyable<T>(std::forward<Args>(args)...);
+  else
+    return make_copyable<T>(std::forward<Args>(args)...);
+}
+
+template <typename T, typename... Args>
+AutoNonCopyable<T> make_auto_noncopyable(Args&&... args) {
+  if constexpr (OptionalStorageOf<T>::value == OptionalStorageKind::Niche)
+    return make_niche_noncopyable<T>(std::forward<Args>(args)...);
+  else if constexpr (OptionalStorageOf<T>::value == OptionalStorageKind::Inline)
+    return make_inline_noncopyable<T>(std::forward<Args>(args)...);
+  else
+    return make_noncopyable<T>(std::forward<Args>(args)...);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Layout checks: each storage strategy is picked when it should be, costs no
+// more space than it should, and keeps T's trivial copies
+////////////////////////////////////////////////////////////////////////////////
+static_assert(std::is_same<AutoCopyable<bool>, NicheCopyable<bool>>::value,
+              "bool should be stored in its niche");
+static_assert(std::is_same<AutoCopyable<std::reference_wrapper<int>>,
+                           NicheCopyable<std::reference_wrapper<int>>>::value,
+              "std::reference_wrapper should be stored in its niche");
+static_assert(std::is_same<AutoCopyable<int>, InlineCopyable<int>>::value,
+              "Small trivially copyable types should be stored inline");
+static_assert(std::is_same<AutoCopyable<char[65]>, Copyable<char[65]>>::value,
+              "Types bigger than OptionalInlineLimit should be stored on the heap");
+static_assert(std::is_same<AutoCopyable<std::vector<int>>, Copyable<std::vector<int>>>::value,
+              "Types that aren't trivially copyable should be stored on the heap");
+static_assert(sizeof(NicheCopyable<bool>) == sizeof(bool) &&
+              sizeof(NicheNonCopyable<bool>) == sizeof(bool),
+              "Niche storage should be no bigger than the type");
+static_assert(sizeof(NicheCopyable<std::reference_wrapper<int>>) == sizeof(int*),
+              "Niche storage should be no bigger than the type");
+static_assert(sizeof(InlineCopyable<int>) == 2 * sizeof(int) &&
+              alignof(InlineCopyable<double>) == alignof(double),
+              "Inline storage should only add a flag, padded to T's alignment");
+static_assert(std::is_trivially_copyable<NicheCopyable<bool>>::value &&
+              std::is_trivially_copyable<InlineCopyable<int>>::value,
+              "Inline storage of trivially copyable types should be trivially copyable");
+static_assert(std::is_trivially_destructible<InlineNonCopyable<int>>::value &&
+              std::is_trivially_destructible<NicheNonCopyable<bool>>::value,
+              "Inline storage of trivially destructible types should be trivially destructible");
+
 }  // namespace optional
 }  // namespace helper
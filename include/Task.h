@@ -0,0 +1,555 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2016 Matthew Bedder (bedder@gmail.com)
+//
+// This code has been released under the MIT license. See the LICENSE file in
+// the project root for more information
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "ThreadPool.h"
+
+#if !HELPER_THREADPOOL_COROUTINES
+#error "Task.h needs a compiler with C++20 coroutine support (e.g. -std=c++20)"
+#endif
+
+// Define HELPER_TASK_FRAME_CACHE as 0 to allocate coroutine frames with the
+// global operator new, rather than recycling them through FrameCache.
+#ifndef HELPER_TASK_FRAME_CACHE
+#define HELPER_TASK_FRAME_CACHE 1
+#endif
+
+namespace helper {
+
+////////////////////////////////////////////////////////////////////////////////
+// FrameCache
+//   Recycles coroutine frames. Each thread keeps a free list of frames for
+//   each size class (multiples of 64 bytes, up to kMaxSize), and allocates
+//   from it without locking. A coroutine that hops between workers is often
+//   freed on a different thread to the one that allocated it, so threads
+//   that free more frames than they allocate pass them on in batches of
+//   kBatchSize through a shared list, which threads that run out take them
+//   from. Larger frames, and frames beyond what the lists hold, go straight
+//   to the global operator new and delete.
+////////////////////////////////////////////////////////////////////////////////
+class FrameCache {
+public:
+  static constexpr size_t kClassSize  = 64;
+  static constexpr size_t kMaxSize    = 1024;
+  static constexpr size_t kBatchSize  = 32;
+  static constexpr size_t kMaxBatches = 64;  // Shared, per size class
+
+  static void* allocate(size_t size);
+  static void  deallocate(void* frame, size_t size) noexcept;
+
+private:
+  static constexpr size_t kClasses = kMaxSize / kClassSize;
+
+  struct FreeFrame {
+    FreeFrame* next;
+    FreeFrame* nextBatch;  // Only used by the first frame of a shared batch
+  };
+
+  struct Lists {
+    FreeFrame* head[kClasses]  = {};
+    size_t     count[kClasses] = {};
+    ~Lists();
+  };
+
+  struct Shared {
+    std::mutex mt;
+    FreeFrame* batches[kClasses]  = {};
+    size_t     nBatches[kClasses] = {};
+  };
+
+  static size_t sizeClass(size_t size) { return (size - 1) / kClassSize; }
+  static Lists* lists();
+  static Shared& shared();
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Task<T>
+//   A coroutine returning a T, which doesn't start until it's awaited (or
+//   passed to syncWait). The awaiting coroutine is suspended until the task
+//   finishes, and is then resumed on the same thread that finished the task,
+//   so after a task has moved onto a pool with co_await pool.schedule(), the
+//   code awaiting it carries on on that pool too. Exceptions thrown by the
+//   task are rethrown by co_await.
+//
+//   Usage:
+//       Task<int> parse(ThreadPool& pool, std::string text) {
+//         co_await pool.schedule();          // Now running on a worker
+//         co_return std::stoi(text);
+//       }
+//
+//       Task<int> sum(ThreadPool& pool, std::vector<std::string> texts) {
+//         std::vector<Task<int>> parses;
+//         for (auto& text : texts)
+//           parses.push_back(parse(pool, text));
+//         int total = 0;
+//         for (int x : co_await whenAll(std::move(parses)))
+//           total += x;
+//         co_return total;
+//       }
+//
+//       int total = syncWait(sum(thread_pool, texts));
+//
+//   whenAll starts each task in turn on the awaiting thread, and resumes the
+//   awaiting coroutine once they've all finished. whenAny resumes it as soon
+//   as one has finished, with that task's index and result; the others carry
+//   on in the background. Tasks that should run in parallel should start with
+//   co_await pool.schedule(), as above.
+//
+//   A Task is move-only, and can only be awaited once.
+////////////////////////////////////////////////////////////////////////////////
+template <typename T = void>
+class Task;
+
+// The parts of a Task's promise that don't depend on T
+class TaskPromiseBase {
+public:
+  std::suspend_always initial_suspend() const noexcept { return {}; }
+  // When the task finishes, carry straight on with whoever awaited it
+  struct FinalAwaiter {
+    bool await_ready() const noexcept { return false; }
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+      return handle.promise().continuation_;
+    }
+    void await_resume() const noexcept {}
+  };
+  FinalAwaiter final_suspend() const noexcept { return {}; }
+  void unhandled_exception() noexcept { error_ = std::current_exception(); }
+
+#if HELPER_TASK_FRAME_CACHE
+  static void* operator new(size_t size) { return FrameCache::allocate(size); }
+  static void operator delete(void* frame, size_t size) noexcept {
+    FrameCache::deallocate(frame, size);
+  }
+#endif
+
+  void setContinuation(std::coroutine_handle<> continuation) {
+    continuation_ = continuation;
+  }
+  void rethrowIfFailed() const {
+    if (error_)
+      std::rethrow_exception(error_);
+  }
+
+private:
+  std::coroutine_handle<> continuation_ = std::noop_coroutine();
+  std::exception_ptr      error_;
+};
+
+template <typename T>
+class TaskPromise : public TaskPromiseBase {
+public:
+  Task<T> get_return_object() noexcept;
+  template <typename U>
+  void return_value(U&& value) { value_.emplace(std::forward<U>(value)); }
+  T result() {
+    rethrowIfFailed();
+    return std::move(*value_);
+  }
+private:
+  std::optional<T> value_;
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase {
+public:
+  Task<void> get_return_object() noexcept;
+  void return_void() const noexcept {}
+  void result() const { rethrowIfFailed(); }
+};
+
+template <typename T>
+class Task {
+public:
+  using promise_type = TaskPromise<T>;
+  using Handle       = std::coroutine_handle<promise_type>;
+
+  Task() = default;
+  explicit Task(Handle handle) : handle_(handle) {}
+  Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+  Task& operator=(Task&& other) noexcept {
+    if (this != &other) {
+      if (handle_)
+        handle_.destroy();
+      handle_ = std::exchange(other.handle_, nullptr);
+    }
+    return *this;
+  }
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+  ~Task() {
+    if (handle_)
+      handle_.destroy();
+  }
+
+  bool valid() const { return static_cast<bool>(handle_); }
+
+  // Starts the task, by transferring straight to it from the awaiting
+  // coroutine
+  class Awaiter {
+  public:
+    explicit Awaiter(Handle handle) : handle_(handle) {}
+    bool await_ready() const noexcept { return !handle_; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+      handle_.promise().setContinuation(awaiting);
+      return handle_;
+    }
+    T await_resume() {
+      if (!handle_)
+        throw std::logic_error("Task : Awaiting an empty task.");
+      return handle_.promise().result();
+    }
+  private:
+    Handle handle_;
+  };
+
+  Awaiter operator co_await() const noexcept { return Awaiter(handle_); }
+
+private:
+  Handle handle_ = nullptr;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+Task<T> TaskPromise<T>::get_return_object() noexcept {
+  return Task<T>(Task<T>::Handle::from_promise(*this));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+Task<void> TaskPromise<void>::get_return_object() noexcept {
+  return Task<void>(Task<void>::Handle::from_promise(*this));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// DetachedCoroutine
+//   Used to drive Tasks from whenAll, whenAny and syncWait. It starts
+//   suspended, and destroys itself once it's finished, so whatever it's waiting
+//   for doesn't have to outlive it.
+////////////////////////////////////////////////////////////////////////////////
+class DetachedCoroutine {
+public:
+  struct promise_type {
+    DetachedCoroutine get_return_object() noexcept {
+      return DetachedCoroutine(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    std::suspend_never  final_suspend() const noexcept { return {}; }
+    void return_void() const noexcept {}
+    void unhandled_exception() const noexcept { std::terminate(); }
+#if HELPER_TASK_FRAME_CACHE
+    static void* operator new(size_t size) { return FrameCache::allocate(size); }
+    static void operator delete(void* frame, size_t size) noexcept {
+      FrameCache::deallocate(frame, size);
+    }
+#endif
+  };
+
+  explicit DetachedCoroutine(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+  void start() { handle_.resume(); }
+
+private:
+  std::coroutine_handle<promise_type> handle_;
+};
+
+// Destroys the awaiting (detached) coroutine and carries on with `next`
+struct ContinueWith {
+  std::coroutine_handle<> next;
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> self) noexcept {
+    std::coroutine_handle<> then = next;  // We're about to destroy ourselves
+    self.destroy();
+    return then;
+  }
+  void await_resume() const noexcept {}
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// CoroutineLatch
+//   Resumes a coroutine once count arrivals have been made. The coroutine
+//   itself counts as one arrival, once it's finished starting everything
+//   it's waiting for, so it can't be resumed while it's still doing that.
+////////////////////////////////////////////////////////////////////////////////
+class CoroutineLatch {
+public:
+  explicit CoroutineLatch(size_t count) : count_(count + 1) {}
+
+  // The coroutine to continue with after arriving
+  std::coroutine_handle<> arrive() noexcept {
+    if (count_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      return waiter_;
+    return std::noop_coroutine();
+  }
+
+  template <typename Start>
+  class Awaiter {
+  public:
+    Awaiter(CoroutineLatch& latch, Start start) : latch_(latch), start_(std::move(start)) {}
+    bool await_ready() const noexcept { return false; }
+    bool await_suspend(std::coroutine_handle<> waiter) {
+      latch_.waiter_ = waiter;
+      start_();
+      // Stay suspended unless everything finished while we were starting it
+      return latch_.count_.fetch_sub(1, std::memory_order_acq_rel) != 1;
+    }
+    void await_resume() const noexcept {}
+  private:
+    CoroutineLatch& latch_;
+    Start           start_;
+  };
+
+  // co_await latch.wait(start) calls start(), then waits for the arrivals
+  template <typename Start>
+  Awaiter<Start> wait(Start start) { return Awaiter<Start>(*this, std::move(start)); }
+
+private:
+  std::atomic<size_t>     count_;
+  std::coroutine_handle<> waiter_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Results of the tasks run by whenAll, whenAny and syncWait
+template <typename T>
+struct TaskOutcome {
+  std::optional<T>   value;
+  std::exception_ptr error;
+  T get() {
+    if (error)
+      std::rethrow_exception(error);
+    return std::move(*value);
+  }
+};
+
+template <>
+struct TaskOutcome<void> {
+  std::exception_ptr error;
+  void get() const {
+    if (error)
+      std::rethrow_exception(error);
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Awaits task, putting its result in outcome, then carries on with whatever
+// next() returns
+template <typename T, typename Next>
+DetachedCoroutine runTaskInto(Task<T>& task, TaskOutcome<T>& outcome, Next next) {
+  try {
+    if constexpr (std::is_void_v<T>)
+      co_await task;
+    else
+      outcome.value.emplace(co_await task);
+  } catch (...) {
+    outcome.error = std::current_exception();
+  }
+  co_await ContinueWith{ next() };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// What whenAll and whenAny return for tasks returning T
+template <typename T>
+using WhenAllResult = std::conditional_t<std::is_void_v<T>, void, std::vector<T>>;
+template <typename T>
+using WhenAnyResult = std::conditional_t<std::is_void_v<T>, size_t, std::pair<size_t, T>>;
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+Task<WhenAllResult<T>> whenAll(std::vector<Task<T>> tasks) {
+  std::vector<TaskOutcome<T>> outcomes(tasks.size());
+  CoroutineLatch latch(tasks.size());
+  co_await latch.wait([&]() {
+    for (size_t i = 0; i < tasks.size(); i++)
+      runTaskInto(tasks[i], outcomes[i], [&latch]() { return latch.arrive(); }).start();
+  });
+  // Rethrow the first exception, or collect the results
+  if constexpr (std::is_void_v<T>) {
+    for (auto& outcome : outcomes)
+      outcome.get();
+  } else {
+    std::vector<T> results;
+    results.reserve(outcomes.size());
+    for (auto& outcome : outcomes)
+      results.push_back(outcome.get());
+    co_return results;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// whenAny's tasks may still be running after it returns, so everything they
+// need is kept in a shared state that the last of them frees
+template <typename T>
+struct WhenAnyState {
+  explicit WhenAnyState(std::vector<Task<T>> tasks_)
+  : tasks(std::move(tasks_)), outcomes(tasks.size()) {}
+  std::vector<Task<T>>        tasks;
+  std::vector<TaskOutcome<T>> outcomes;
+  CoroutineLatch              latch{1};  // Arrived at by the first to finish
+  std::atomic<bool>           finished{false};
+  size_t                      winner = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+Task<WhenAnyResult<T>> whenAny(std::vector<Task<T>> tasks) {
+  if (tasks.empty())
+    throw std::logic_error("whenAny : No tasks to wait for.");
+  auto state = std::make_shared<WhenAnyState<T>>(std::move(tasks));
+  co_await state->latch.wait([&state]() {
+    for (size_t i = 0; i < state->tasks.size(); i++) {
+      // Each part holds a reference to the state until it's finished
+      runTaskInto(state->tasks[i], state->outcomes[i], [state, i]() {
+        if (state->finished.exchange(true, std::memory_order_acq_rel))
+          return std::coroutine_handle<>(std::noop_coroutine());
+        state->winner = i;
+        return state->latch.arrive();
+      }).start();
+    }
+  });
+  const size_t winner = state->winner;
+  if constexpr (std::is_void_v<T>) {
+    state->outcomes[winner].get();
+    co_return winner;
+  } else {
+    co_return std::pair<size_t, T>(winner, state->outcomes[winner].get());
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Runs a task from ordinary (non-coroutine) code, blocking until it finishes
+template <typename T>
+T syncWait(Task<T> task) {
+  TaskOutcome<T>          outcome;
+  std::mutex              mt;
+  std::condition_variable cv;
+  bool                    done = false;
+  runTaskInto(task, outcome, [&]() {
+    std::lock_guard<std::mutex> guard(mt);
+    done = true;
+    cv.notify_one();
+    return std::coroutine_handle<>(std::noop_coroutine());
+  }).start();
+  {
+    std::unique_lock<std::mutex> lock(mt);
+    cv.wait(lock, [&done]() { return done; });
+  }
+  return outcome.get();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void* FrameCache::allocate(size_t size) {
+  if (size > kMaxSize)
+    return ::operator new(size);
+  // Small frames always get their whole size class, even without a cache (as
+  // the thread exits), as another thread may free them into one
+  const size_t c = sizeClass(size);
+  Lists* l = lists();
+  if (!l)
+    return ::operator new((c + 1) * kClassSize);
+
+  if (!l->head[c]) {
+    // Take a batch freed by another thread, if there is one
+    Shared& s = shared();
+    std::lock_guard<std::mutex> guard(s.mt);
+    if (FreeFrame* batch = s.batches[c]) {
+      s.batches[c] = batch->nextBatch;
+      s.nBatches[c]--;
+      l->head[c]  = batch;
+      l->count[c] = kBatchSize;
+    }
+  }
+  if (FreeFrame* frame = l->head[c]) {
+    l->head[c] = frame->next;
+    l->count[c]--;
+    return frame;
+  }
+  // Allocate the whole size class, so the frame can be reused for any size
+  // in it
+  return ::operator new((c + 1) * kClassSize);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void FrameCache::deallocate(void* frame, size_t size) noexcept {
+  Lists* l = (size <= kMaxSize) ? lists() : nullptr;
+  if (!l) {
+    ::operator delete(frame);
+    return;
+  }
+
+  const size_t c = sizeClass(size);
+  l->head[c] = new (frame) FreeFrame{ l->head[c], nullptr };
+  if (++l->count[c] < 2 * kBatchSize)
+    return;
+
+  // Pass the oldest kBatchSize frames on
+  FreeFrame* last = l->head[c];
+  for (size_t i = 1; i < kBatchSize; i++)
+    last = last->next;
+  FreeFrame* batch = last->next;
+  last->next  = nullptr;
+  l->count[c] = kBatchSize;
+  {
+    Shared& s = shared();
+    std::lock_guard<std::mutex> guard(s.mt);
+    if (s.nBatches[c] < kMaxBatches) {
+      batch->nextBatch = s.batches[c];
+      s.batches[c]     = batch;
+      s.nBatches[c]++;
+      return;
+    }
+  }
+  while (batch) {
+    FreeFrame* next = batch->next;
+    ::operator delete(batch);
+    batch = next;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+FrameCache::Lists::~Lists() {
+  for (size_t c = 0; c < kClasses; c++) {
+    while (FreeFrame* frame = head[c]) {
+      head[c] = frame->next;
+      ::operator delete(frame);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+FrameCache::Lists* FrameCache::lists() {
+  // The lists are destroyed when the thread exits, after which any frames it
+  // frees (e.g. from other thread_local destructors) go straight to delete
+  struct Holder {
+    Lists lists;
+    bool& alive;
+    explicit Holder(bool& a) : alive(a) { alive = true; }
+    ~Holder() { alive = false; }
+  };
+  thread_local bool alive = false;
+  thread_local Holder holder(alive);
+  return alive ? &holder.lists : nullptr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+FrameCache::Shared& FrameCache::shared() {
+  // Never destroyed, as threads may still be freeing frames during exit
+  static Shared* s = new Shared();
+  return *s;
+}
+
+}  // namespace helper
@@ -0,0 +1,213 @@
+////////////////////////////////////////////////////////////////////////////////
+// Copyright (c) 2016 Matthew Bedder (bedder@gmail.com)
+//
+// This code has been released under the MIT license. See the LICENSE file in
+// the project root for more information
+////////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "ThreadPool.h"
+
+namespace helper {
+
+////////////////////////////////////////////////////////////////////////////////
+// TaskGraph
+//   A set of tasks (nodes) with dependencies between them (edges), run on a
+//   ThreadPool. Rather than waiting for a whole stage of tasks to finish
+//   before starting the next, each node is handed to the pool as soon as the
+//   last of its predecessors finishes, so independent chains of work overlap.
+//
+//   Usage:
+//       TaskGraph graph;
+//       TaskGraph::Node load   = graph.addNode([]() { ... });
+//       TaskGraph::Node parse  = graph.addNode([]() { ... });
+//       TaskGraph::Node index  = graph.addNode([]() { ... });
+//       TaskGraph::Node render = graph.addNode([]() { ... });
+//       graph.addEdge(load, parse);   // parse runs after load...
+//       graph.addEdge(parse, index);
+//       graph.addEdge(parse, render); // ... and index and render after parse
+//       graph.run(thread_pool);
+//
+//   run() returns once every node has run. Like TaskGroup::wait, the calling
+//   thread helps run queued tasks while it waits, so a graph can be run from
+//   inside a task. If a node throws, nodes that haven't started yet are
+//   skipped and the first exception is rethrown by run().
+//
+//   Each node keeps an atomic count of its unfinished predecessors, which is
+//   reset at the start of each run. Everything a run needs is set up the first
+//   time the graph is run after being changed, so running the same graph again
+//   doesn't allocate. A graph can't be changed, or run again, while running.
+////////////////////////////////////////////////////////////////////////////////
+class TaskGraph {
+public:
+  using Node = size_t;
+
+  TaskGraph() = default;
+  TaskGraph(const TaskGraph&) = delete;
+  TaskGraph& operator=(const TaskGraph&) = delete;
+
+  template <typename F>
+  Node addNode(F function);
+  void addEdge(Node before, Node after);
+  size_t size() const { return nodes_.size(); }
+  void run(ThreadPool& pool);
+
+private:
+  static constexpr Node kNoNode = static_cast<Node>(-1);
+
+  struct NodeInfo {
+    std::function<void()> function;
+    std::vector<Node>     successors;
+    size_t                nPredecessors = 0;
+  };
+
+  // State shared by the tasks of a single run
+  struct Run {
+    TaskGroup&                  group;
+    ThreadPool::FirstException& error;
+  };
+
+  std::vector<NodeInfo> nodes_;
+  std::vector<Node>     roots_;  // Nodes without predecessors
+  std::unique_ptr<std::atomic<size_t>[]> pending_;  // Unfinished predecessors
+  bool                  prepared_ = false;
+  std::atomic<bool>     running_{false};
+
+  void checkNotRunning(const std::string& caller) const;
+  void prepare();
+  void dispatch(Run& run, Node node);
+  void runNode(Run& run, Node node);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename F>
+TaskGraph::Node TaskGraph::addNode(F function) {
+  checkNotRunning("TaskGraph::addNode");
+  nodes_.push_back({ std::function<void()>(std::move(function)), {}, 0 });
+  prepared_ = false;
+  return nodes_.size() - 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void TaskGraph::addEdge(Node before, Node after) {
+  checkNotRunning("TaskGraph::addEdge");
+  if (before >= nodes_.size() || after >= nodes_.size())
+    throw std::logic_error("TaskGraph::addEdge : Unknown node.");
+  if (before == after)
+    throw std::logic_error("TaskGraph::addEdge : A node can't depend on itself.");
+  nodes_[before].successors.push_back(after);
+  nodes_[after].nPredecessors++;
+  prepared_ = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void TaskGraph::run(ThreadPool& pool) {
+  // Claim the graph in one step, so that two concurrent runs can't both start
+  if (running_.exchange(true))
+    throw std::logic_error("TaskGraph::run : The graph is already running.");
+  try {
+    if (!prepared_)
+      prepare();
+  } catch (...) {
+    running_ = false;
+    throw;
+  }
+  if (nodes_.empty()) {
+    running_ = false;
+    return;
+  }
+
+  for (Node i = 0; i < nodes_.size(); i++)
+    pending_[i].store(nodes_[i].nPredecessors, std::memory_order_relaxed);
+
+  ThreadPool::FirstException error;
+  {
+    TaskGroup group(pool);
+    Run run{ group, error };
+    for (Node i = 1; i < roots_.size(); i++)
+      dispatch(run, roots_[i]);
+    runNode(run, roots_[0]);
+    group.wait();
+  }
+  running_ = false;
+  error.rethrow();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void TaskGraph::checkNotRunning(const std::string& caller) const {
+  if (running_)
+    throw std::logic_error(caller + " : The graph is already running.");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void TaskGraph::prepare() {
+  // Find the roots, and make sure every node can be reached from them (i.e.
+  // there are no cycles) by running through the graph in topological order
+  roots_.clear();
+  std::vector<size_t> remaining(nodes_.size());
+  std::vector<Node>   ready;
+  for (Node i = 0; i < nodes_.size(); i++) {
+    remaining[i] = nodes_[i].nPredecessors;
+    if (remaining[i] == 0)
+      roots_.push_back(i);
+  }
+  ready = roots_;
+  size_t visited = 0;
+  while (!ready.empty()) {
+    const Node node = ready.back();
+    ready.pop_back();
+    visited++;
+    for (Node successor : nodes_[node].successors) {
+      if (--remaining[successor] == 0)
+        ready.push_back(successor);
+    }
+  }
+  if (visited != nodes_.size())
+    throw std::logic_error("TaskGraph::run : The graph contains a cycle.");
+
+  pending_.reset(new std::atomic<size_t>[nodes_.size()]);
+  prepared_ = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void TaskGraph::dispatch(Run& run, Node node) {
+  // The node must run even if the pool drops the task, or its successors
+  // would never be released
+  auto task = [this, &run, node]() { runNode(run, node); };
+  run.group.addTask(ThreadPool::MustRunTask<decltype(task)>(task));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void TaskGraph::runNode(Run& run, Node node) {
+  while (node != kNoNode) {
+    if (!run.error.caught()) {
+      try {
+        nodes_[node].function();
+      } catch (...) {
+        run.error.capture();
+      }
+    }
+    // Release the successors. We carry on with the first one that's ready
+    // ourselves, which saves a trip through the queue for chains of nodes.
+    Node next = kNoNode;
+    for (Node successor : nodes_[node].successors) {
+      if (pending_[successor].fetch_sub(1, std::memory_order_acq_rel) != 1)
+        continue;
+      if (next == kNoNode)
+        next = successor;
+      else
+        dispatch(run, successor);
+    }
+    node = next;
+  }
+}
+
+}  // namespace helper
@@ -7,215 +7,3617 @@
 
 #pragma once
 
-#include <thread>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <new>
+#include <optional>
 #include <ostream>
-#include <queue>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#endif
+
+// Define HELPER_THREADPOOL_STATS as 1 (before including this file, or on the
+// compiler's command line) to have ThreadPool collect the counters, histograms
+// and trace returned by ThreadPool::stats and writeTrace. Otherwise none of it
+// is compiled in.
+#ifndef HELPER_THREADPOOL_STATS
+#define HELPER_THREADPOOL_STATS 0
+#endif
+
+// ThreadPool::schedule (and Task.h) need C++20 coroutines
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define HELPER_THREADPOOL_COROUTINES 1
+#else
+#define HELPER_THREADPOOL_COROUTINES 0
+#endif
+
+namespace helper {
+
+////////////////////////////////////////////////////////////////////////////////
+// SchedulingMode
+//   Controls how a ThreadPool distributes tasks between its workers:
+//     SharedQueue  - every task goes through a single mutex-guarded queue. This
+//                    is simple and strictly FIFO, but every addTask and every
+//                    dequeue contends on the same lock.
+//     WorkStealing - every worker owns a deque. Tasks added from inside a task
+//                    are pushed to (and popped from) the back of the current
+//                    worker's deque, tasks added from outside the pool go to a
+//                    shared injection queue, and idle workers steal from the
+//                    front of the other workers' deques.
+////////////////////////////////////////////////////////////////////////////////
+enum class SchedulingMode {
+  SharedQueue,
+  WorkStealing
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// QueueFullPolicy
+//   Controls what ThreadPool::addTask (and submit, TaskGroup::addTask, ...) does
+//   when a bounded task queue is full:
+//     Block      - wait until a worker frees up a slot (tasks added by the
+//                  pool's own workers are run immediately instead, as there
+//                  may be nobody left to free up a slot)
+//     Reject     - drop the new task and log an error. TaskFutures of dropped
+//                  tasks receive a broken_promise error.
+//     CallerRuns - run the new task immediately on the calling thread
+//     DropOldest - drop the oldest queued task to make room for the new one
+//                  (the oldest of the new task's priority, or the task with
+//                  the earliest deadline)
+//   ThreadPool::tryAddTask never blocks, and returns false when the queue is
+//   full whatever the policy.
+////////////////////////////////////////////////////////////////////////////////
+enum class QueueFullPolicy {
+  Block,
+  Reject,
+  CallerRuns,
+  DropOldest
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// QueueOrder
+//   Controls the order in which a ThreadPool runs queued tasks:
+//     Priority              - tasks are given a priority (0 is the most urgent,
+//                             up to ThreadPoolOptions::priorityLevels - 1) and
+//                             tasks of equal priority run first come, first
+//                             served. With one priority level this is a plain
+//                             FIFO queue.
+//     EarliestDeadlineFirst - tasks are given a deadline, and the task with the
+//                             earliest deadline runs first
+////////////////////////////////////////////////////////////////////////////////
+enum class QueueOrder {
+  Priority,
+  EarliestDeadlineFirst
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// CpuTopology
+//   The machine's CPUs (hardware threads), and the physical core and NUMA node
+//   each one belongs to. detect() reads the Linux sysfs topology, falling back
+//   to a single node of std::thread::hardware_concurrency() CPUs when that
+//   isn't available. simulated() makes up a machine, so NUMA-aware placement
+//   can be tried out on a single-node box. Nodes and cores are numbered from 0
+//   even if the system's own numbering has gaps.
+////////////////////////////////////////////////////////////////////////////////
+class CpuTopology {
+public:
+  struct Cpu {
+    int    id;    // The OS's CPU number, as used by pthread_setaffinity_np
+    size_t core;
+    size_t node;
+  };
+
+  static CpuTopology detect(const std::string& sysfsRoot = "/sys/devices/system");
+  static CpuTopology simulated(size_t nNodes, size_t coresPerNode, size_t threadsPerCore = 1);
+
+  bool   empty()     const { return cpus_.empty(); }
+  size_t nodeCount() const { return nNodes_; }
+  size_t coreCount() const { return nCores_; }
+  const std::vector<Cpu>& cpus() const { return cpus_; }
+
+  // The CPUs of one NUMA node
+  std::vector<int> nodeCpus(size_t node) const;
+  // The CPUs of each physical core, taking a core from each node in turn so
+  // that the first few cores are spread across the nodes
+  std::vector<std::vector<int>> physicalCores() const;
+  // The node of an OS CPU number, or 0 if it isn't known
+  size_t nodeOf(int cpu) const;
+
+private:
+  std::vector<Cpu> cpus_;
+  size_t           nNodes_ = 0;
+  size_t           nCores_ = 0;
+
+  static std::vector<int> parseCpuList(const std::string& list);
+  static bool readFile(const std::string& path, std::string& contents);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+CpuTopology CpuTopology::detect(const std::string& sysfsRoot) {
+  std::string contents;
+  std::vector<int> online;
+  if (readFile(sysfsRoot + "/cpu/online", contents))
+    online = parseCpuList(contents);
+  if (online.empty())
+    return simulated(1, std::max(1u, std::thread::hardware_concurrency()));
+
+  // Number the nodes that have CPUs, in the system's order
+  std::map<int, size_t> nodeOfCpu;
+  size_t nNodes = 0;
+  std::vector<int> nodes;
+  if (readFile(sysfsRoot + "/node/possible", contents))
+    nodes = parseCpuList(contents);
+  for (int node : nodes) {
+    if (!readFile(sysfsRoot + "/node/node" + std::to_string(node) + "/cpulist", contents))
+      continue;
+    std::vector<int> cpus = parseCpuList(contents);
+    if (cpus.empty())
+      continue;
+    for (int cpu : cpus)
+      nodeOfCpu.emplace(cpu, nNodes);
+    nNodes++;
+  }
+
+  CpuTopology topology;
+  topology.nNodes_ = std::max<size_t>(1, nNodes);
+  std::map<std::pair<std::string, std::string>, size_t> cores;
+  for (int cpu : online) {
+    const std::string dir = sysfsRoot + "/cpu/cpu" + std::to_string(cpu) + "/topology/";
+    std::string package, core;
+    if (!readFile(dir + "physical_package_id", package) || !readFile(dir + "core_id", core)) {
+      // Treat each CPU as a core of its own
+      package = "cpu";
+      core    = std::to_string(cpu);
+    }
+    auto inserted = cores.emplace(std::make_pair(package, core), cores.size());
+    auto node     = nodeOfCpu.find(cpu);
+    topology.cpus_.push_back({ cpu, inserted.first->second,
+                               (node == nodeOfCpu.end()) ? 0 : node->second });
+  }
+  topology.nCores_ = cores.size();
+  return topology;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+CpuTopology CpuTopology::simulated(size_t nNodes, size_t coresPerNode, size_t threadsPerCore) {
+  // Number the CPUs the way Linux usually does, with a CPU for each core
+  // followed by the second hardware thread of each core, and so on
+  CpuTopology topology;
+  topology.nNodes_ = std::max<size_t>(1, nNodes);
+  topology.nCores_ = topology.nNodes_ * std::max<size_t>(1, coresPerNode);
+  for (size_t thread = 0; thread < std::max<size_t>(1, threadsPerCore); thread++) {
+    for (size_t core = 0; core < topology.nCores_; core++) {
+      topology.cpus_.push_back({ static_cast<int>(thread * topology.nCores_ + core), core,
+                                 core / std::max<size_t>(1, coresPerNode) });
+    }
+  }
+  return topology;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::vector<int> CpuTopology::nodeCpus(size_t node) const {
+  std::vector<int> cpus;
+  for (const Cpu& cpu : cpus_) {
+    if (cpu.node == node)
+      cpus.push_back(cpu.id);
+  }
+  return cpus;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::vector<std::vector<int>> CpuTopology::physicalCores() const {
+  std::vector<std::vector<int>> cpusOfCore(nCores_);
+  std::vector<std::vector<size_t>> coresOfNode(nNodes_);
+  for (const Cpu& cpu : cpus_) {
+    if (cpusOfCore[cpu.core].empty())
+      coresOfNode[cpu.node].push_back(cpu.core);
+    cpusOfCore[cpu.core].push_back(cpu.id);
+  }
+  std::vector<std::vector<int>> cores;
+  for (size_t i = 0; cores.size() < nCores_; i++) {
+    for (const auto& nodeCores : coresOfNode) {
+      if (i < nodeCores.size())
+        cores.push_back(cpusOfCore[nodeCores[i]]);
+    }
+  }
+  return cores;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+size_t CpuTopology::nodeOf(int cpu) const {
+  for (const Cpu& c : cpus_) {
+    if (c.id == cpu)
+      return c.node;
+  }
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::vector<int> CpuTopology::parseCpuList(const std::string& list) {
+  // e.g. "0-3,8-11"
+  std::vector<int> cpus;
+  std::istringstream ranges(list);
+  std::string range;
+  while (std::getline(ranges, range, ',')) {
+    int first = 0, last = 0;
+    char dash = 0;
+    std::istringstream parts(range);
+    if (!(parts >> first))
+      continue;
+    if (!(parts >> dash >> last) || dash != '-')
+      last = first;
+    for (int cpu = first; cpu <= last; cpu++)
+      cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool CpuTopology::readFile(const std::string& path, std::string& contents) {
+  std::ifstream file(path);
+  if (!file || !std::getline(file, contents))
+    return false;
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// WorkerPlacement
+//   Controls which CPUs a ThreadPool's workers may run on:
+//     None          - leave it to the OS
+//     CpuSets       - pin worker i to ThreadPoolOptions::cpuSets[i % n]
+//     PhysicalCores - pin each worker to a physical core (and its hardware
+//                     threads), taking cores from each NUMA node in turn
+//     NumaNodes     - pin the workers to the CPUs of each NUMA node in turn
+//   Pinning uses pthread_setaffinity_np, so is only supported on Linux.
+////////////////////////////////////////////////////////////////////////////////
+enum class WorkerPlacement {
+  None,
+  CpuSets,
+  PhysicalCores,
+  NumaNodes
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// NodeHint
+//   Asks ThreadPool::addTask to run a task on a worker of the given NUMA node
+//   (numbered as in CpuTopology), e.g. the node holding the task's data.
+////////////////////////////////////////////////////////////////////////////////
+struct NodeHint {
+  size_t node;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// IdlePolicy
+//   Controls what a ThreadPool worker does when it runs out of tasks:
+//     Park         - wait on a condition variable straight away. Costs no CPU
+//                    while idle, but a task added to an idle pool has to wait
+//                    for a worker to be woken up by the OS.
+//     SpinThenPark - poll for new tasks spinCount times (with a CPU pause
+//                    instruction between polls), then yieldCount times
+//                    (yielding to other threads between polls), and only then
+//                    park
+//     Adaptive     - as SpinThenPark, but each worker adjusts its own spin
+//                    budget between spinCount / 64 and spinCount: it's halved
+//                    whenever the worker spins without finding a task, and
+//                    doubled whenever a task turns up while spinning, so
+//                    workers spin when tasks are arriving close together and
+//                    park quickly when they aren't
+//   Spinning workers pick up new tasks by themselves, so adding a task only
+//   wakes a parked worker if there are more tasks queued than workers
+//   spinning. On single-CPU machines workers always park.
+////////////////////////////////////////////////////////////////////////////////
+enum class IdlePolicy {
+  Park,
+  SpinThenPark,
+  Adaptive
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// ThreadPoolOptions
+//   Construction options for ThreadPool. The defaults match the behaviour of
+//   ThreadPool(nThreads, logStream).
+//
+//   A non-zero queueCapacity replaces the mutex-guarded shared queue (the
+//   injection queue when work stealing) with a lock-free ring buffer of that
+//   many tasks (rounded up to a power of two), with fullPolicy deciding what
+//   happens when producers outrun the workers. Work-stealing workers' own
+//   deques stay unbounded. With several priority levels each level gets a ring
+//   buffer of its own; in EarliestDeadlineFirst order the capacity limits the
+//   (mutex-guarded) deadline queue instead.
+//
+//   Tasks added without a priority get defaultPriority. So that a steady stream
+//   of urgent tasks can't starve the rest, a lower priority level with tasks
+//   waiting is served anyway once starvationLimit tasks have been taken from
+//   above it. In EarliestDeadlineFirst order, tasks added without a deadline
+//   are due defaultDeadline after they were added.
+//
+//   With a placement other than WorkerPlacement::None the pool keeps a shared
+//   queue per NUMA node of the topology (detected if left empty). Tasks added
+//   with a NodeHint go to that node's queue, tasks added by a worker go to its
+//   own node's queue, and other tasks are spread across the nodes. Workers
+//   only take tasks from (or steal from workers of) another node once their
+//   own node has run out of work. Set pinWorkers to false to keep the per-node
+//   queues without pinning, e.g. with a CpuTopology::simulated topology.
+//
+//   In HELPER_THREADPOOL_STATS builds, a non-zero traceCapacity keeps the last
+//   traceCapacity tasks run by each worker for ThreadPool::writeTrace.
+//
+//   ThreadPool::resize can change the number of workers at any time, up to
+//   maxThreads (by default the larger of nThreads and twice the number of
+//   hardware threads). With autoscale set, the pool also resizes itself: a
+//   worker is added whenever the estimated time tasks spend queued exceeds
+//   targetQueueWait, and workers that have been idle for keepAlive are
+//   retired, down to minThreads.
+//
+//   Timers (ThreadPool::addTaskAfter and friends) are kept to a resolution of
+//   timerResolution: a task is added to the pool on the first tick at or
+//   after the time it's due.
+//
+//   If the pool has a log stream, up to logCapacity LogRecords can be waiting
+//   to be written per worker before any more are dropped.
+//
+//   With a dequeueBatch above 1, a worker taking tasks from a plain FIFO shared
+//   queue (one priority level, no capacity) takes up to dequeueBatch of them
+//   at once, but no more than its share of the queued tasks. It runs the
+//   first, and keeps the rest on its own deque, where idle workers can steal
+//   them. This cuts the locking when many small tasks are added at once.
+////////////////////////////////////////////////////////////////////////////////
+struct ThreadPoolOptions {
+  size_t          nThreads        = 4;
+  SchedulingMode  scheduling      = SchedulingMode::SharedQueue;
+  size_t          queueCapacity   = 0;  // Zero for an unbounded queue
+  QueueFullPolicy fullPolicy      = QueueFullPolicy::Block;
+  QueueOrder      order           = QueueOrder::Priority;
+  size_t          priorityLevels  = 1;
+  size_t          defaultPriority = 0;
+  size_t          starvationLimit = 16;
+  std::chrono::steady_clock::duration defaultDeadline = std::chrono::milliseconds(100);
+  WorkerPlacement placement       = WorkerPlacement::None;
+  std::vector<std::vector<int>> cpuSets;  // For WorkerPlacement::CpuSets
+  CpuTopology     topology;               // Detected if empty
+  bool            pinWorkers      = true;
+  size_t          traceCapacity   = 0;    // Trace events kept per worker
+  IdlePolicy      idlePolicy      = IdlePolicy::Park;
+  size_t          spinCount       = 4096;
+  size_t          yieldCount      = 16;
+  size_t          maxThreads      = 0;
+  bool            autoscale       = false;
+  size_t          minThreads      = 1;
+  std::chrono::steady_clock::duration targetQueueWait = std::chrono::milliseconds(1);
+  std::chrono::steady_clock::duration keepAlive       = std::chrono::seconds(10);
+  std::chrono::steady_clock::duration timerResolution = std::chrono::milliseconds(1);
+  size_t          logCapacity     = 256;  // Log records buffered per worker
+  size_t          dequeueBatch    = 1;    // Tasks a worker takes from the queue at once
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// LogRecord
+//   Something a ThreadPool has logged. Records are queued as they are, in a
+//   lock-free buffer per worker (plus one for all other threads), and only
+//   formatted and written to the log stream by a background thread, so
+//   logging never blocks a worker or interleaves output. If a buffer is full
+//   the record is dropped and counted (see ThreadPool::droppedLogMessages).
+////////////////////////////////////////////////////////////////////////////////
+enum class LogSeverity {
+  Info,
+  Warning,
+  Error
+};
+
+struct LogRecord {
+  static constexpr size_t kNoWorker   = SIZE_MAX;
+  static constexpr size_t kDetailSize = 112;
+
+  LogSeverity                           severity = LogSeverity::Error;
+  size_t                                worker   = kNoWorker;  // That it's about
+  std::chrono::steady_clock::time_point time;
+  const char*                           message  = "";  // A string literal
+  char                                  detail[kDetailSize] = {};  // Truncated copy
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// LatencyHistogram
+//   A histogram of durations in nanoseconds, in the style of HdrHistogram:
+//   values below kSubBuckets are counted exactly, and above that each power of
+//   two is split into kSubBuckets buckets, so percentiles are accurate to
+//   within 1/kSubBuckets (~6%) of the value whatever its magnitude.
+////////////////////////////////////////////////////////////////////////////////
+class LatencyHistogram {
+public:
+  static constexpr size_t kSubBucketBits = 4;
+  static constexpr size_t kSubBuckets    = size_t(1) << kSubBucketBits;
+  static constexpr size_t kBuckets       = kSubBuckets * (64 - kSubBucketBits + 1);
+
+  void record(uint64_t value) {
+    counts_[bucketOf(value)]++;
+    count_++;
+    sum_ += value;
+    max_  = std::max(max_, value);
+  }
+
+  void merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < kBuckets; i++)
+      counts_[i] += other.counts_[i];
+    count_ += other.count_;
+    sum_   += other.sum_;
+    max_    = std::max(max_, other.max_);
+  }
+
+  uint64_t count() const { return count_; }
+  uint64_t max()   const { return max_; }
+  double   mean()  const { return count_ ? static_cast<double>(sum_) / count_ : 0.0; }
+
+  // The value that `percentile` percent of the recorded values are at or below
+  // (rounded up to the top of its bucket)
+  uint64_t percentile(double percentile) const {
+    if (count_ == 0)
+      return 0;
+    const double wanted = std::max(1.0, std::min(100.0, percentile) / 100.0 * count_);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBuckets; i++) {
+      seen += counts_[i];
+      if (seen >= wanted)
+        return std::min(bucketUpperBound(i), max_);
+    }
+    return max_;
+  }
+
+  static size_t bucketOf(uint64_t value) {
+    if (value < kSubBuckets)
+      return static_cast<size_t>(value);
+    size_t exponent = 63;
+    while (!(value >> exponent))
+      exponent--;
+    const size_t shift = exponent - kSubBucketBits;
+    return kSubBuckets * (shift + 1) + static_cast<size_t>(value >> shift) - kSubBuckets;
+  }
+
+  static uint64_t bucketUpperBound(size_t bucket) {
+    if (bucket < kSubBuckets)
+      return bucket;
+    const size_t shift = bucket / kSubBuckets - 1;
+    const uint64_t top = bucket % kSubBuckets + kSubBuckets + 1;
+    return (shift + kSubBucketBits >= 63 && top >= 2 * kSubBuckets) ? UINT64_MAX
+                                                                    : (top << shift) - 1;
+  }
+
+private:
+  friend class ThreadPool;
+
+  std::vector<uint64_t> counts_ = std::vector<uint64_t>(kBuckets);
+  uint64_t count_ = 0;
+  uint64_t sum_   = 0;
+  uint64_t max_   = 0;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// ThreadPoolStats
+//   A snapshot of a ThreadPool's counters, as returned by ThreadPool::stats().
+//   There's an entry in `workers` for each worker, followed by one for threads
+//   outside the pool that ran tasks (QueueFullPolicy::CallerRuns, or helping
+//   out in TaskGroup::wait). `total` sums the workers (taking the largest
+//   high-water mark). Times are in nanoseconds.
+//
+//   Only HELPER_THREADPOOL_STATS builds collect anything - otherwise the
+//   snapshot is always empty.
+////////////////////////////////////////////////////////////////////////////////
+struct ThreadPoolStats {
+  struct Worker {
+    uint64_t tasksRun       = 0;
+    uint64_t steals         = 0;  // Tasks taken from another worker's deque
+    uint64_t busyTime       = 0;  // Time spent running tasks
+    uint64_t idleTime       = 0;  // Time spent waiting for tasks
+    size_t   queueHighWater = 0;  // Most tasks ever queued when adding one
+  };
+
+  std::vector<Worker> workers;
+  Worker              total;
+  LatencyHistogram    queueWait;  // From adding a task to it starting
+  LatencyHistogram    runTime;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// InlineTask
+//   A move-only replacement for std::function<void()> used to store tasks in a
+//   ThreadPool. Callables of up to kInlineSize bytes (with a non-throwing move
+//   CTOR) are stored inside the InlineTask itself, so queuing them never
+//   touches the heap; larger callables fall back to a heap allocation. Unlike
+//   std::function, the callable doesn't need to be copyable.
+////////////////////////////////////////////////////////////////////////////////
+class InlineTask {
+public:
+  static constexpr size_t kInlineSize = 112;
+
+  InlineTask() = default;
+
+  template <typename F,
+            typename = std::enable_if_t<!std::is_same<std::decay_t<F>, InlineTask>::value>>
+  InlineTask(F&& function) {
+    using Callable = std::decay_t<F>;
+    if (isInline<Callable>()) {
+      new (&storage_) Callable(std::forward<F>(function));
+    } else {
+      Callable* callable = new Callable(std::forward<F>(function));
+      std::memcpy(&storage_, &callable, sizeof(callable));
+    }
+    ops_ = &opsFor<Callable>();
+  }
+
+  InlineTask(InlineTask&& other) noexcept {
+    moveFrom(other);
+  }
+
+  InlineTask& operator=(InlineTask&& other) noexcept {
+    if (this != &other) {
+      reset();
+      moveFrom(other);
+    }
+    return *this;
+  }
+
+  InlineTask(const InlineTask&) = delete;
+  InlineTask& operator=(const InlineTask&) = delete;
+
+  ~InlineTask() { reset(); }
+
+  explicit operator bool() const { return ops_ != nullptr; }
+  void operator()()              { ops_->invoke(&storage_); }
+
+#if HELPER_THREADPOOL_STATS
+  // When the task was added to the pool, for ThreadPool::stats
+  std::chrono::steady_clock::time_point queuedAt;
+#endif
+
+  // Destroy the stored callable (if any), leaving the InlineTask empty
+  void reset() {
+    if (ops_ != nullptr) {
+      ops_->destroy(&storage_);
+      ops_ = nullptr;
+    }
+  }
+
+private:
+  // Type-erased operations on the stored callable
+  struct Ops {
+    void (*invoke)(void* storage);
+    void (*move)(void* to, void* from);  // Move-constructs and destroys `from`
+    void (*destroy)(void* storage);
+  };
+
+  template <typename Callable>
+  static constexpr bool isInline() {
+    return sizeof(Callable) <= kInlineSize
+        && alignof(Callable) <= alignof(std::max_align_t)
+        && std::is_nothrow_move_constructible<Callable>::value;
+  }
+
+  template <typename Callable>
+  static Callable* get(void* storage) {
+    if (isInline<Callable>())
+      return static_cast<Callable*>(storage);
+    Callable* callable;
+    std::memcpy(&callable, storage, sizeof(callable));
+    return callable;
+  }
+
+  template <typename Callable>
+  static const Ops& opsFor() {
+    static const Ops ops = {
+      [](void* storage) { (*get<Callable>(storage))(); },
+      [](void* to, void* from) {
+        if (isInline<Callable>()) {
+          new (to) Callable(std::move(*get<Callable>(from)));
+          get<Callable>(from)->~Callable();
+        } else {
+          std::memcpy(to, from, sizeof(Callable*));
+        }
+      },
+      [](void* storage) {
+        if (isInline<Callable>())
+          get<Callable>(storage)->~Callable();
+        else
+          delete get<Callable>(storage);
+      }
+    };
+    return ops;
+  }
+
+  void moveFrom(InlineTask& other) {
+    if (other.ops_ != nullptr) {
+      other.ops_->move(&storage_, &other.storage_);
+      ops_ = other.ops_;
+      other.ops_ = nullptr;
+    }
+#if HELPER_THREADPOOL_STATS
+    queuedAt = other.queuedAt;
+#endif
+  }
+
+  alignas(std::max_align_t) unsigned char storage_[kInlineSize];
+  const Ops* ops_ = nullptr;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// TaskDeque
+//   A growable ring buffer of InlineTasks, used for the ThreadPool task queues.
+//   Unlike std::deque/std::queue it never frees or reallocates storage once
+//   it's big enough, so a steady stream of push/pop calls doesn't allocate.
+////////////////////////////////////////////////////////////////////////////////
+class TaskDeque {
+public:
+  bool   empty() const { return size_ == 0; }
+  size_t size()  const { return size_; }
+
+  void push_back(InlineTask&& task) {
+    if (size_ == tasks_.size())
+      grow();
+    tasks_[(head_ + size_) & (tasks_.size() - 1)] = std::move(task);
+    size_++;
+  }
+
+  InlineTask pop_front() {
+    InlineTask task = std::move(tasks_[head_]);
+    head_ = (head_ + 1) & (tasks_.size() - 1);
+    size_--;
+    return task;
+  }
+
+  InlineTask pop_back() {
+    size_--;
+    return std::move(tasks_[(head_ + size_) & (tasks_.size() - 1)]);
+  }
+
+  void clear() {
+    while (!empty())
+      pop_front();
+    head_ = 0;
+  }
+
+private:
+  std::vector<InlineTask> tasks_;  // Size is always zero or a power of two
+  size_t head_ = 0;
+  size_t size_ = 0;
+
+  void grow() {
+    std::vector<InlineTask> tasks(std::max<size_t>(16, 2 * tasks_.size()));
+    for (size_t i = 0; i < size_; i++)
+      tasks[i] = std::move(tasks_[(head_ + i) & (tasks_.size() - 1)]);
+    tasks_.swap(tasks);
+    head_ = 0;
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// TaskState<R>
+//   The state shared between a task added by ThreadPool::submit and the
+//   TaskFuture<R> returned to the caller. It is reference counted (one
+//   reference for each side) and recycled through a small per-thread free list
+//   rather than being freed, so steady-state submit() calls don't allocate.
+//
+//   This class is not intended to be used directly - use ThreadPool::submit.
+////////////////////////////////////////////////////////////////////////////////
+template <typename R>
+class TaskState {
+public:
+  // References are stored as pointers, and void results as an empty struct
+  struct Void {};
+  using Value = std::conditional_t<std::is_void<R>::value, Void,
+                std::conditional_t<std::is_reference<R>::value,
+                                   std::remove_reference_t<R>*, R>>;
+
+  static TaskState* acquire() {
+    Cache& cache = cache_();
+    TaskState* state;
+    if (cache.states.empty()) {
+      state = new TaskState();
+    } else {
+      state = cache.states.back();
+      cache.states.pop_back();
+    }
+    state->refs_ = 2;  // One for the task, one for the TaskFuture
+    return state;
+  }
+
+  // Producer side: store the result (or exception) and drop the task's
+  // reference. Both sides drop their references under the lock, and the
+  // task's goes before the result can be seen, so a TaskFuture that has seen
+  // it always drops the last reference. That keeps the state out of the way
+  // of a TaskFuture that is destroyed as soon as ready() is true, and returns
+  // it to the cache of the thread that submitted the task rather than the
+  // worker's.
+  template <typename... V>
+  void setValue(V&&... value) {
+    std::unique_lock<std::mutex> lock(mt_);
+    value_.emplace(std::forward<V>(value)...);
+    complete(lock);
+  }
+
+  void setException(std::exception_ptr error) {
+    std::unique_lock<std::mutex> lock(mt_);
+    error_ = error;
+    complete(lock);
+  }
+
+  // Consumer side
+  bool ready() const { return ready_; }
+
+  void wait() {
+    std::unique_lock<std::mutex> lock(mt_);
+    cv_.wait(lock, [this]() { return ready_.load(); });
+  }
+
+  Value take() {
+    wait();
+    if (error_)
+      std::rethrow_exception(error_);
+    return std::move(*value_);
+  }
+
+  void release() {
+    bool last;
+    {
+      std::lock_guard<std::mutex> guard(mt_);
+      last = (--refs_ == 0);
+    }
+    if (last)
+      recycle(this);
+  }
+
+private:
+  // Up to kMaxCached states are kept by each thread for reuse
+  static constexpr size_t kMaxCached = 256;
+
+  struct Cache {
+    std::vector<TaskState*> states;
+    Cache()  { states.reserve(kMaxCached); }
+    ~Cache() { for (TaskState* state : states) delete state; }
+  };
+
+  std::mutex              mt_;
+  std::condition_variable cv_;
+  std::atomic<bool>       ready_{false};
+  std::atomic<int>        refs_{0};
+  std::optional<Value>    value_;
+  std::exception_ptr      error_;
+
+  static Cache& cache_() {
+    static thread_local Cache cache;
+    return cache;
+  }
+
+  static void recycle(TaskState* state) {
+    state->value_.reset();
+    state->error_ = nullptr;
+    state->ready_ = false;
+    Cache& cache = cache_();
+    if (cache.states.size() < kMaxCached)
+      cache.states.push_back(state);
+    else
+      delete state;
+  }
+
+  void complete(std::unique_lock<std::mutex>& lock) {
+    ready_ = true;
+    cv_.notify_all();
+    const bool last = (--refs_ == 0);
+    lock.unlock();
+    // Only when the TaskFuture has already gone, so nobody is waiting
+    if (last)
+      recycle(this);
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// TaskFuture<R>
+//   A handle to the result of a task added by ThreadPool::submit, similar to
+//   std::future<R>. get() blocks until the task has run, then returns its
+//   result or rethrows any exception it threw. If the task is abandoned by the
+//   pool (e.g. waitUntilComplete(false, true)) get() throws a
+//   std::future_error with std::future_errc::broken_promise.
+////////////////////////////////////////////////////////////////////////////////
+template <typename R>
+class TaskFuture {
+public:
+  TaskFuture() = default;
+  explicit TaskFuture(TaskState<R>* state) : state_(state) {}
+  TaskFuture(TaskFuture&& other) noexcept : state_(other.state_) { other.state_ = nullptr; }
+  TaskFuture& operator=(TaskFuture&& other) noexcept {
+    std::swap(state_, other.state_);
+    return *this;
+  }
+  TaskFuture(const TaskFuture&) = delete;
+  TaskFuture& operator=(const TaskFuture&) = delete;
+  ~TaskFuture() { if (state_) state_->release(); }
+
+  bool valid() const { return state_ != nullptr; }
+  bool ready() const { return state_ != nullptr && state_->ready(); }
+  void wait()  const { state_->wait(); }
+
+  // Can only be called once, after which the TaskFuture is no longer valid
+  R get() {
+    TaskFuture<R> self(std::move(*this));
+    return unwrap(self.state_->take());
+  }
+
+private:
+  TaskState<R>* state_ = nullptr;
+
+  static R unwrap(typename TaskState<R>::Value&& value) {
+    if constexpr (std::is_void<R>::value)
+      return;
+    else if constexpr (std::is_reference<R>::value)
+      return static_cast<R>(*value);
+    else
+      return std::move(value);
+  }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// SubmittedTask<R, F, Args...>
+//   The callable queued by ThreadPool::submit: runs F(Args...) and hands the
+//   result to the shared TaskState. If it's destroyed without being run, the
+//   TaskFuture receives a broken_promise error instead of waiting forever.
+////////////////////////////////////////////////////////////////////////////////
+template <typename R, typename F, typename... Args>
+class SubmittedTask {
+public:
+  SubmittedTask(TaskState<R>* state, F function, Args... args)
+  : state_(state),
+    function_(std::move(function)),
+    args_(std::move(args)...) {}
+
+  void operator()() {
+    TaskState<R>* state = state_.release();
+    try {
+      if constexpr (std::is_void<R>::value) {
+        std::apply(std::move(function_), std::move(args_));
+        state->setValue();
+      } else if constexpr (std::is_reference<R>::value) {
+        state->setValue(&std::apply(std::move(function_), std::move(args_)));
+      } else {
+        state->setValue(std::apply(std::move(function_), std::move(args_)));
+      }
+    } catch (...) {
+      state->setException(std::current_exception());
+    }
+  }
+
+private:
+  // Called if the task is destroyed before it has run
+  struct Abandon {
+    void operator()(TaskState<R>* state) const {
+      state->setException(std::make_exception_ptr(
+          std::future_error(std::future_errc::broken_promise)));
+    }
+  };
+
+  std::unique_ptr<TaskState<R>, Abandon> state_;
+  F                                      function_;
+  std::tuple<Args...>                    args_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// BoundedQueue
+//   A fixed-capacity, lock-free, multi-producer/multi-consumer ring buffer
+//   (Dmitry Vyukov's bounded MPMC queue). Each cell carries a sequence number
+//   saying whether it's ready to be written or read, so producers and
+//   consumers only contend on the two position counters. Cells and counters
+//   are padded to separate cache lines to avoid false sharing.
+//
+//   Used as BoundedTaskQueue (of InlineTasks) when ThreadPoolOptions::
+//   queueCapacity is set, and for ThreadPool's log buffers.
+////////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class BoundedQueue {
+public:
+  static constexpr size_t kCacheLineSize = 64;
+
+  // The capacity is rounded up to a power of two
+  explicit BoundedQueue(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity)
+      size *= 2;
+    cells_.reset(new Cell[size]);
+    mask_ = size - 1;
+    for (size_t i = 0; i < size; i++)
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  size_t capacity() const { return mask_ + 1; }
+
+  // Moves from `item` and returns true, or returns false (leaving `item`
+  // alone) if the queue is full
+  bool tryPush(T& item) {
+    size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+    while (1) {
+      Cell& cell = cells_[pos & mask_];
+      const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          cell.item = std::move(item);
+          cell.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;  // The cell still holds an item from the previous lap
+      } else {
+        pos = enqueuePos_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Returns false if the queue is empty
+  bool tryPop(T& item) {
+    size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+    while (1) {
+      Cell& cell = cells_[pos & mask_];
+      const size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      const intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          item = std::move(cell.item);
+          cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;  // The cell hasn't been written yet
+      } else {
+        pos = dequeuePos_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+private:
+  struct alignas(kCacheLineSize) Cell {
+    std::atomic<size_t> sequence;
+    T                   item;
+  };
+
+  std::unique_ptr<Cell[]> cells_;
+  size_t                  mask_;
+  alignas(kCacheLineSize) std::atomic<size_t> enqueuePos_{0};
+  alignas(kCacheLineSize) std::atomic<size_t> dequeuePos_{0};
+};
+
+using BoundedTaskQueue = BoundedQueue<InlineTask>;
+
+////////////////////////////////////////////////////////////////////////////////
+// SharedTaskQueue
+//   The queue shared by all of a ThreadPool's workers (the injection queue when
+//   work stealing). Depending on the ThreadPoolOptions it is made up of:
+//     QueueOrder::Priority              - one FIFO lane per priority level,
+//                                         either mutex-guarded TaskDeques or
+//                                         (if queueCapacity is set) lock-free
+//                                         BoundedTaskQueues
+//     QueueOrder::EarliestDeadlineFirst - a mutex-guarded min-heap on deadline
+//
+//   Lanes are served highest priority (lane 0) first. To stop a busy lane
+//   starving the lanes below it, each waiting lane counts how many tasks have
+//   been taken from above it, and is served next once that reaches
+//   starvationLimit. In EDF mode, tasks without a deadline are given one of
+//   defaultDeadline from when they were added, so they age into the front of
+//   the queue.
+//
+//   This class is not intended to be used directly - use ThreadPool.
+////////////////////////////////////////////////////////////////////////////////
+class SharedTaskQueue {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // Use the queue's default priority (or no deadline)
+  static constexpr size_t            kDefaultPriority = SIZE_MAX;
+  static constexpr Clock::time_point kNoDeadline      = Clock::time_point::max();
+
+  explicit SharedTaskQueue(const ThreadPoolOptions& options)
+  : order_(options.order),
+    capacity_(options.queueCapacity),
+    defaultPriority_(std::min(options.defaultPriority,
+                              std::max<size_t>(1, options.priorityLevels) - 1)),
+    starvationLimit_(std::max<size_t>(1, options.starvationLimit)),
+    defaultDeadline_(options.defaultDeadline),
+    nLanes_(order_ == QueueOrder::Priority ? std::max<size_t>(1, options.priorityLevels) : 1),
+    depths_(new std::atomic<size_t>[nLanes_]),
+    skipped_(new std::atomic<size_t>[nLanes_]) {
+    for (size_t i = 0; i < nLanes_; i++) {
+      depths_[i]  = 0;
+      skipped_[i] = 0;
+    }
+    if (order_ == QueueOrder::Priority && capacity_ > 0) {
+      for (size_t i = 0; i < nLanes_; i++)
+        boundedLanes_.push_back(std::make_unique<BoundedTaskQueue>(capacity_));
+    } else if (order_ == QueueOrder::Priority) {
+      lanes_.resize(nLanes_);
+    }
+  }
+
+  size_t priorityLevels()       const { return nLanes_; }
+  size_t depth(size_t priority) const { return priority < nLanes_ ? depths_[priority].load() : 0; }
+
+  // True if there are tasks that should jump ahead of a work-stealing worker's
+  // own (default priority) tasks
+  bool hasUrgent() const { return urgent_ > 0; }
+
+  // Moves from `task` and returns true, or returns false (leaving `task`
+  // alone) if the queue is full
+  bool tryPush(InlineTask& task, size_t priority, Clock::time_point deadline) {
+    if (order_ == QueueOrder::EarliestDeadlineFirst) {
+      const bool urgent = (deadline != kNoDeadline);
+      if (!urgent)
+        deadline = Clock::now() + defaultDeadline_;
+      std::lock_guard<std::mutex> guard(mt_);
+      if (capacity_ > 0 && deadlines_.size() >= capacity_)
+        return false;
+      deadlines_.push_back({ deadline, sequence_++, urgent, std::move(task) });
+      std::push_heap(deadlines_.begin(), deadlines_.end(), laterDeadline);
+      added(0, urgent);
+      return true;
+    }
+
+    const size_t lane   = laneFor(priority);
+    const bool   urgent = (lane < defaultPriority_);
+    if (!boundedLanes_.empty()) {
+      // Count the task before it's visible, so depths never under-count
+      added(lane, urgent);
+      if (boundedLanes_[lane]->tryPush(task))
+        return true;
+      removed(lane, urgent);
+      return false;
+    }
+    std::lock_guard<std::mutex> guard(mt_);
+    lanes_[lane].push_back(std::move(task));
+    added(lane, urgent);
+    return true;
+  }
+
+  // Moves from the first of the n tasks that fit, taking the lock once for the
+  // batch, and returns how many that was (the rest are left alone)
+  size_t tryPushMany(InlineTask* tasks, size_t n, size_t priority, Clock::time_point deadline) {
+    if (order_ == QueueOrder::EarliestDeadlineFirst) {
+      const bool urgent = (deadline != kNoDeadline);
+      if (!urgent)
+        deadline = Clock::now() + defaultDeadline_;
+      std::lock_guard<std::mutex> guard(mt_);
+      size_t pushed = 0;
+      for (; pushed < n && (capacity_ == 0 || deadlines_.size() < capacity_); pushed++) {
+        deadlines_.push_back({ deadline, sequence_++, urgent, std::move(tasks[pushed]) });
+        std::push_heap(deadlines_.begin(), deadlines_.end(), laterDeadline);
+      }
+      added(0, urgent, pushed);
+      return pushed;
+    }
+
+    if (!boundedLanes_.empty()) {
+      // The ring buffers are lock-free anyway
+      size_t pushed = 0;
+      while (pushed < n && tryPush(tasks[pushed], priority, deadline))
+        pushed++;
+      return pushed;
+    }
+    const size_t lane = laneFor(priority);
+    std::lock_guard<std::mutex> guard(mt_);
+    for (size_t i = 0; i < n; i++)
+      lanes_[lane].push_back(std::move(tasks[i]));
+    added(lane, lane < defaultPriority_, n);
+    return n;
+  }
+
+  // Returns false if the queue is empty
+  bool tryPop(InlineTask& task) {
+    if (size_ == 0)
+      return false;
+
+    if (order_ == QueueOrder::EarliestDeadlineFirst) {
+      std::lock_guard<std::mutex> guard(mt_);
+      if (deadlines_.empty())
+        return false;
+      std::pop_heap(deadlines_.begin(), deadlines_.end(), laterDeadline);
+      task = std::move(deadlines_.back().task);
+      removed(0, deadlines_.back().urgent);
+      deadlines_.pop_back();
+      return true;
+    }
+
+    // Serve the highest priority lane with work, unless a lane below it has
+    // been passed over too many times
+    size_t lane = nLanes_;
+    for (size_t i = 0; i < nLanes_; i++) {
+      if (depths_[i] == 0)
+        continue;
+      if (lane == nLanes_) {
+        lane = i;
+      } else if (++skipped_[i] >= starvationLimit_) {
+        lane = i;
+        break;
+      }
+    }
+    if (lane < nLanes_ && popLane(lane, task))
+      return true;
+    // We lost a race for that lane, so take anything we can
+    for (size_t i = 0; i < nLanes_; i++) {
+      if (popLane(i, task))
+        return true;
+    }
+    return false;
+  }
+
+  // Pops up to max tasks (in order) into tasks, taking the lock once, and
+  // returns how many. Only a plain FIFO queue (one priority level, unbounded)
+  // gives more than one, as the others have to choose each task in turn.
+  size_t tryPopMany(InlineTask* tasks, size_t max) {
+    if (max <= 1 || order_ != QueueOrder::Priority || nLanes_ != 1 || !boundedLanes_.empty())
+      return (max > 0 && tryPop(tasks[0])) ? 1 : 0;
+    if (size_ == 0)
+      return 0;
+    size_t n = 0;
+    {
+      std::lock_guard<std::mutex> guard(mt_);
+      while (n < max && !lanes_[0].empty())
+        tasks[n++] = lanes_[0].pop_front();
+    }
+    removed(0, 0 < defaultPriority_, n);
+    return n;
+  }
+
+  // Used by QueueFullPolicy::DropOldest to make room for a task of the given
+  // priority: takes the task that would be run next from that task's lane
+  bool tryPopOldest(InlineTask& task, size_t priority) {
+    if (order_ == QueueOrder::EarliestDeadlineFirst)
+      return tryPop(task);
+    return popLane(laneFor(priority), task);
+  }
+
+private:
+  struct DeadlineTask {
+    Clock::time_point deadline;
+    uint64_t          sequence;  // Keeps tasks with equal deadlines FIFO
+    bool              urgent;
+    InlineTask        task;
+  };
+
+  static bool laterDeadline(const DeadlineTask& a, const DeadlineTask& b) {
+    return (a.deadline != b.deadline) ? a.deadline > b.deadline : a.sequence > b.sequence;
+  }
+
+  size_t laneFor(size_t priority) const {
+    return (priority == kDefaultPriority) ? defaultPriority_ : std::min(priority, nLanes_ - 1);
+  }
+
+  void added(size_t lane, bool urgent, size_t n = 1) {
+    depths_[lane] += n;
+    size_ += n;
+    if (urgent)
+      urgent_ += n;
+  }
+
+  void removed(size_t lane, bool urgent, size_t n = 1) {
+    depths_[lane] -= n;
+    size_ -= n;
+    if (urgent)
+      urgent_ -= n;
+  }
+
+  bool popLane(size_t lane, InlineTask& task) {
+    if (!boundedLanes_.empty()) {
+      if (!boundedLanes_[lane]->tryPop(task))
+        return false;
+    } else {
+      std::lock_guard<std::mutex> guard(mt_);
+      if (lanes_[lane].empty())
+        return false;
+      task = lanes_[lane].pop_front();
+    }
+    skipped_[lane] = 0;
+    removed(lane, lane < defaultPriority_);
+    return true;
+  }
+
+  const QueueOrder      order_;
+  const size_t          capacity_;
+  const size_t          defaultPriority_;
+  const size_t          starvationLimit_;
+  const Clock::duration defaultDeadline_;
+  const size_t          nLanes_;
+
+  std::mutex                mt_;     // Guards lanes_, deadlines_ and sequence_
+  std::vector<TaskDeque>    lanes_;
+  std::vector<std::unique_ptr<BoundedTaskQueue>> boundedLanes_;
+  std::vector<DeadlineTask> deadlines_;
+  uint64_t                  sequence_ = 0;
+
+  std::unique_ptr<std::atomic<size_t>[]> depths_;   // Tasks in each lane
+  std::unique_ptr<std::atomic<size_t>[]> skipped_;  // Times each lane was passed over
+  std::atomic<size_t> size_{0};
+  std::atomic<size_t> urgent_{0};
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// TimerWheel
+//   Holds the pending timers of ThreadPool::addTaskAfter, addTaskAt and
+//   addPeriodicTask, as a hierarchical timing wheel. Time is counted in ticks
+//   (ThreadPoolOptions::timerResolution), and the wheel has kLevels levels of
+//   kSlots slots: a slot of level 0 holds the timers due on a single tick, a
+//   slot of level 1 those due in a span of kSlots ticks, and so on. When the
+//   wheel reaches a slot of level 0 every timer in it is due, and each time a
+//   level wraps around, the next slot of the level above is spread out over
+//   it. Adding, cancelling and firing a timer are all O(1), however many are
+//   pending. Timers due beyond the top level wait in its last slot and are
+//   spread out again from there.
+//
+//   Timers are kept in one deque, linked into their slot's list by index,
+//   and their storage is reused once they've fired or been cancelled, so
+//   adding a timer doesn't allocate once the deque has grown. It isn't
+//   thread safe; ThreadPool guards it with a mutex.
+////////////////////////////////////////////////////////////////////////////////
+class TimerWheel {
+public:
+  static constexpr size_t   kLevels   = 4;
+  static constexpr size_t   kSlotBits = 6;
+  static constexpr size_t   kSlots    = size_t(1) << kSlotBits;  // One bit each in a uint64_t
+  static constexpr uint32_t kNone     = UINT32_MAX;
+
+  // Identifies a timer. The generation changes each time a timer's storage
+  // is reused, so an old id can't cancel a newer timer.
+  struct Id {
+    uint32_t index      = kNone;
+    uint32_t generation = 0;
+  };
+
+  TimerWheel() { std::fill(std::begin(heads_), std::end(heads_), kNone); }
+
+  // Timers due on or before the current tick fire on the next one. A
+  // periodic timer calls makeTask for a new task each time it fires.
+  Id add(uint64_t due, InlineTask task);
+  Id addPeriodic(uint64_t due, uint64_t interval, std::function<InlineTask()> makeTask);
+  bool cancel(Id id);
+  void clear();
+
+  // Moves the wheel on to tick `now`, appending the tasks of the timers that
+  // fire to `due`
+  void advance(uint64_t now, std::vector<InlineTask>& due);
+  // The next tick at which advance has something to do, if anything's pending
+  std::optional<uint64_t> nextTick() const;
+
+  uint64_t now() const  { return now_; }
+  size_t   size() const { return size_; }
+
+private:
+  struct Timer {
+    InlineTask                  task;
+    std::function<InlineTask()> makeTask;  // Periodic timers only
+    uint64_t                    due        = 0;
+    uint64_t                    interval   = 0;
+    uint32_t                    prev       = kNone;
+    uint32_t                    next       = kNone;  // Also links the free list
+    uint32_t                    slot       = kNone;  // level * kSlots + slot, if pending
+    uint32_t                    generation = 0;
+  };
+
+  std::deque<Timer> timers_;  // Doesn't move timers as it grows
+  uint32_t           free_ = kNone;
+  uint32_t           heads_[kLevels * kSlots];
+  uint64_t           occupied_[kLevels] = {};  // Bit i set if slot i has timers
+  uint64_t           now_  = 0;
+  size_t             size_ = 0;
+
+  static uint64_t rotateRight(uint64_t x, size_t n) {
+    return (n == 0) ? x : (x >> n) | (x << (64 - n));
+  }
+  uint32_t allocate(uint64_t due);
+  void     release(uint32_t index);
+  void     link(uint32_t index);
+  void     unlink(uint32_t index);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+TimerWheel::Id TimerWheel::add(uint64_t due, InlineTask task) {
+  const uint32_t index = allocate(due);
+  timers_[index].task = std::move(task);
+  return Id{ index, timers_[index].generation };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TimerWheel::Id TimerWheel::addPeriodic(uint64_t due, uint64_t interval,
+                                       std::function<InlineTask()> makeTask) {
+  const uint32_t index = allocate(due);
+  timers_[index].interval = std::max<uint64_t>(interval, 1);
+  timers_[index].makeTask = std::move(makeTask);
+  return Id{ index, timers_[index].generation };
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool TimerWheel::cancel(Id id) {
+  if (id.index >= timers_.size())
+    return false;
+  Timer& timer = timers_[id.index];
+  if (timer.generation != id.generation || timer.slot == kNone)
+    return false;  // Already fired, or cancelled
+  unlink(id.index);
+  release(id.index);
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void TimerWheel::clear() {
+  for (uint32_t i = 0; i < timers_.size(); i++) {
+    if (timers_[i].slot != kNone) {
+      unlink(i);
+      release(i);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void TimerWheel::advance(uint64_t now, std::vector<InlineTask>& due) {
+  while (now_ < now) {
+    // Jump straight to the next tick that has anything to do
+    std::optional<uint64_t> next = nextTick();
+    if (!next || *next > now) {
+      now_ = now;
+      return;
+    }
+    now_ = *next;
+
+    // Spread out the slots of every level that wraps around on this tick,
+    // starting from the top so nothing lands in a slot that's already been
+    // spread out
+    size_t top = 0;
+    while (top + 1 < kLevels && (now_ & ((uint64_t(1) << (kSlotBits * (top + 1))) - 1)) == 0)
+      top++;
+    for (size_t level = top; level > 0; level--) {
+      const size_t slot = (now_ >> (kSlotBits * level)) & (kSlots - 1);
+      uint32_t index = heads_[level * kSlots + slot];
+      heads_[level * kSlots + slot] = kNone;
+      occupied_[level] &= ~(uint64_t(1) << slot);
+      while (index != kNone) {
+        const uint32_t nextIndex = timers_[index].next;
+        link(index);
+        index = nextIndex;
+      }
+    }
+
+    // Fire everything in the current slot of level 0
+    const size_t slot = now_ & (kSlots - 1);
+    uint32_t index = heads_[slot];
+    heads_[slot] = kNone;
+    occupied_[0] &= ~(uint64_t(1) << slot);
+    while (index != kNone) {
+      Timer& timer = timers_[index];
+      const uint32_t nextIndex = timer.next;
+      if (timer.makeTask) {
+        due.push_back(timer.makeTask());
+        timer.due = now_ + timer.interval;
+        link(index);
+      } else {
+        due.push_back(std::move(timer.task));
+        timer.slot = kNone;
+        release(index);
+      }
+      index = nextIndex;
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::optional<uint64_t> TimerWheel::nextTick() const {
+  // Slot (position + k) of a level is reached k spans after the current one,
+  // for k = 1 to kSlots, so the first occupied slot after the current one
+  // gives the next tick for that level
+  std::optional<uint64_t> next;
+  for (size_t level = 0; level < kLevels; level++) {
+    if (occupied_[level] == 0)
+      continue;
+    const size_t   shift    = kSlotBits * level;
+    const uint64_t position = now_ >> shift;
+    const uint64_t ahead    = rotateRight(occupied_[level], (position + 1) & (kSlots - 1));
+    uint64_t k = 1;
+    while (!(ahead & (uint64_t(1) << (k - 1))))
+      k++;
+    const uint64_t tick = (position + k) << shift;
+    if (!next || tick < *next)
+      next = tick;
+  }
+  return next;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+uint32_t TimerWheel::allocate(uint64_t due) {
+  uint32_t index = free_;
+  if (index != kNone) {
+    free_ = timers_[index].next;
+  } else {
+    index = static_cast<uint32_t>(timers_.size());
+    timers_.emplace_back();
+  }
+  timers_[index].due = std::max(due, now_ + 1);
+  link(index);
+  size_++;
+  return index;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void TimerWheel::release(uint32_t index) {
+  Timer& timer = timers_[index];
+  timer.task     = InlineTask();
+  timer.makeTask = nullptr;
+  timer.interval = 0;
+  timer.slot     = kNone;
+  timer.generation++;
+  timer.next = free_;
+  free_      = index;
+  size_--;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void TimerWheel::link(uint32_t index) {
+  Timer& timer = timers_[index];
+  const uint64_t delta = timer.due - now_;
+  size_t level = 0;
+  while (level + 1 < kLevels && delta >= (uint64_t(1) << (kSlotBits * (level + 1))))
+    level++;
+  size_t slot;
+  if (delta >= (uint64_t(1) << (kSlotBits * kLevels))) {
+    // Beyond the top level, so wait in its last slot
+    slot = ((now_ >> (kSlotBits * level)) + kSlots - 1) & (kSlots - 1);
+  } else {
+    slot = (timer.due >> (kSlotBits * level)) & (kSlots - 1);
+  }
+  const uint32_t head = static_cast<uint32_t>(level * kSlots + slot);
+  timer.slot = head;
+  timer.prev = kNone;
+  timer.next = heads_[head];
+  if (timer.next != kNone)
+    timers_[timer.next].prev = index;
+  heads_[head] = index;
+  occupied_[level] |= uint64_t(1) << slot;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void TimerWheel::unlink(uint32_t index) {
+  Timer& timer = timers_[index];
+  if (timer.prev != kNone)
+    timers_[timer.prev].next = timer.next;
+  else
+    heads_[timer.slot] = timer.next;
+  if (timer.next != kNone)
+    timers_[timer.next].prev = timer.prev;
+  if (heads_[timer.slot] == kNone)
+    occupied_[timer.slot / kSlots] &= ~(uint64_t(1) << (timer.slot % kSlots));
+  timer.slot = kNone;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// TaskHints
+//   Where and when a ThreadPool should run a task, as given to the addTask
+//   overloads. This class is not intended to be used directly.
+////////////////////////////////////////////////////////////////////////////////
+struct TaskHints {
+  static constexpr size_t kAnyNode = SIZE_MAX;
+
+  size_t                                priority = SharedTaskQueue::kDefaultPriority;
+  std::chrono::steady_clock::time_point deadline = SharedTaskQueue::kNoDeadline;
+  size_t                                node     = kAnyNode;
+};
+
+class TaskGroup;
+class TaskGraph;
+class ThreadPool;
+
+////////////////////////////////////////////////////////////////////////////////
+// TimerHandle
+//   Returned by ThreadPool::addTaskAfter, addTaskAt and addPeriodicTask.
+//   cancel() stops the timer (every future run, for a periodic task), and
+//   returns false if it had already fired or been cancelled. It can't stop a
+//   task that has already been added to the pool. A handle can outlive its
+//   pool, in which case cancel() just returns false.
+////////////////////////////////////////////////////////////////////////////////
+class TimerHandle {
+public:
+  TimerHandle() = default;
+  bool cancel();
+  bool valid() const { return owner_ != nullptr; }
+
+private:
+  friend class ThreadPool;
+
+  // Shared by a pool and all of its handles. The pool clears `pool` (under
+  // `mt`) as it is destroyed, so it can't go while a handle is using it.
+  struct Owner {
+    std::mutex  mt;
+    ThreadPool* pool = nullptr;
+  };
+
+  TimerHandle(std::shared_ptr<Owner> owner, TimerWheel::Id id)
+  : owner_(std::move(owner)), id_(id) {}
+  std::shared_ptr<Owner> owner_;
+  TimerWheel::Id         id_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// ThreadPool
+//   This class allows you to define a pool of N threads that can be used to run
+//   functions operations stored in a queue. This is based off Jakob Progsch's
+//   C++11 Thread Pool (accessible here: http://progsch.net/wordpress/?p=81) but
+//   with changes made for readability, logging, and to allow us to wait for all
+//   threads to complete before terminating.
+//
+//   Usage of this class should be fairly self-explanatory, as follows:
+//       ThreadPool thread_pool(NUM_THREADS, &std::cerr);
+//       for (int i=0 ; i<20 ; i++)
+//         thread_pool.addTask([i]() { fnc_with_side_effect(i); });
+//       thread_pool.waitUntilComplete(true);
+//
+//   For workloads with many small tasks (particularly tasks that add more
+//   tasks) a work-stealing pool avoids the single queue lock:
+//       ThreadPoolOptions options;
+//       options.nThreads   = NUM_THREADS;
+//       options.scheduling = SchedulingMode::WorkStealing;
+//       ThreadPool thread_pool(options, &std::cerr);
+//
+//   waitUntilComplete waits for every task in the pool. To wait for just the
+//   tasks you added yourself, use a TaskGroup:
+//       TaskGroup group(thread_pool);
+//       group.addTask([]() { ... });
+//       group.wait();
+//
+//   Adding many tasks at once is cheaper as a batch, which locks the queue
+//   once and wakes at most one worker per task:
+//       std::vector<std::function<void()>> batch = makeJobs();
+//       thread_pool.addTasks(batch.begin(), batch.end());
+//
+//   To get a task's result (or exception) back, use submit:
+//       TaskFuture<int> answer = thread_pool.submit([](int x) { return x * 2; }, 21);
+//       int result = answer.get();
+//
+//   Loops over large ranges should use the parallel algorithms rather than
+//   adding a task per element. These split the range into chunks (of
+//   chunkSize elements, or a size picked from the number of workers), hand
+//   chunks out to the workers by recursively splitting the range in half, and
+//   run chunks on the calling thread too rather than just blocking:
+//       thread_pool.parallelFor(0, n, [&](int i) { out[i] = f(in[i]); });
+//       double sum = thread_pool.parallelReduce(v.begin(), v.end(), 0.0, std::plus<>());
+//       thread_pool.parallelTransform(v.begin(), v.end(), w.begin(), f);
+//       thread_pool.parallelSort(v.begin(), v.end());
+//   Ranges must be integers or random access iterators. The first exception
+//   thrown by the user's function is rethrown on the calling thread.
+//
+//   By default the task queue is unbounded. To apply backpressure when tasks are
+//   added faster than they're run, give the pool a capacity:
+//       ThreadPoolOptions options;
+//       options.queueCapacity = 1024;
+//       options.fullPolicy    = QueueFullPolicy::CallerRuns;
+//       ThreadPool thread_pool(options, &std::cerr);
+//       if (!thread_pool.tryAddTask(task))
+//         ...  // The queue is full
+//
+//   Tasks normally run in the order they were added. To let urgent tasks jump
+//   the queue, give the pool several priority levels (0 is the most urgent),
+//   or order tasks by deadline instead:
+//       ThreadPoolOptions options;
+//       options.priorityLevels  = 3;
+//       options.defaultPriority = 1;
+//       ThreadPool thread_pool(options, &std::cerr);
+//       thread_pool.addTask(handleRequest, 0);
+//       thread_pool.addTask(compactLogs, 2);
+//       std::vector<size_t> depths = thread_pool.queueDepths();  // Per priority
+//
+//       options.order = QueueOrder::EarliestDeadlineFirst;
+//       ThreadPool edf_pool(options, &std::cerr);
+//       edf_pool.addTask(handleRequest, std::chrono::steady_clock::now() + 5ms);
+//   Priorities are ignored in EarliestDeadlineFirst order, and deadlines in
+//   Priority order. When work stealing, tasks added from inside a task with
+//   the default priority (and no deadline) still go to the worker's own deque.
+//
+//   On NUMA machines, workers can be pinned to CPUs, with a shared queue per
+//   node so a task can be sent to the node that holds its data:
+//       ThreadPoolOptions options;
+//       options.nThreads  = 16;
+//       options.placement = WorkerPlacement::NumaNodes;
+//       ThreadPool thread_pool(options, &std::cerr);
+//       thread_pool.addTask(processShard, NodeHint{ 1 });
+//
+//   The number of workers can be changed while the pool is running, or left to
+//   the pool itself:
+//       thread_pool.resize(8);
+//
+//       ThreadPoolOptions options;
+//       options.nThreads   = 2;
+//       options.maxThreads = 32;
+//       options.autoscale  = true;
+//       ThreadPool elastic_pool(options, &std::cerr);
+//
+//   Building with HELPER_THREADPOOL_STATS defined as 1 adds per-worker
+//   counters, and histograms of how long tasks wait and run, which can be
+//   read at any time. Setting a traceCapacity also records the most recent
+//   tasks, which can be written out for chrome://tracing or Perfetto:
+//       ThreadPoolStats stats = thread_pool.stats();
+//       std::cout << stats.queueWait.percentile(99) << " ns\n";
+//       thread_pool.writeTrace(traceFile);
+//
+//   Tasks can also be added after a delay, at a given time, or periodically,
+//   and cancelled until they're due:
+//       TimerHandle timer = thread_pool.addTaskAfter(std::chrono::seconds(5), retry);
+//       thread_pool.addPeriodicTask(std::chrono::seconds(1), reportProgress);
+//       timer.cancel();
+//   waitUntilComplete doesn't wait for timers that haven't fired.
+//
+//   In C++20, coroutines can hop onto the pool's workers (see Task.h):
+//       Task<int> parse(ThreadPool& pool, std::string text) {
+//         co_await pool.schedule();
+//         co_return std::stoi(text);
+//       }
+//
+//   Note the dependency on ThreadPoolWorker.h
+////////////////////////////////////////////////////////////////////////////////
+class ThreadPool {
+public:
+  friend class ThreadPoolWorker;
+  friend class TaskGroup;
+  friend class TaskGraph;
+  friend class TimerHandle;
+
+public:
+  explicit ThreadPool(size_t nThreads = 4,
+                      std::ostream* logStream = nullptr);
+  explicit ThreadPool(const ThreadPoolOptions& options,
+                      std::ostream* logStream = nullptr);
+  ~ThreadPool();
+
+  using Clock = std::chrono::steady_clock;
+
+  template <typename F>
+  void addTask(F function);
+  template <typename F>
+  void addTask(F function, size_t priority);
+  template <typename F>
+  void addTask(F function, Clock::time_point deadline);
+  template <typename F>
+  void addTask(F function, NodeHint node);
+  template <typename F>
+  bool tryAddTask(F function);
+  template <typename F>
+  bool tryAddTask(F function, size_t priority);
+  // Adds a batch of tasks (copying each callable in [first, last) - use
+  // std::make_move_iterator to move them) with one lock of the queue, and
+  // wakes no more workers than there are tasks
+  template <typename It>
+  void addTasks(It first, It last);
+  template <typename F, typename... Args>
+  TaskFuture<std::invoke_result_t<F, Args...>> submit(F function, Args... args);
+#if HELPER_THREADPOOL_COROUTINES
+  // co_await pool.schedule() suspends the calling coroutine and resumes it on
+  // one of the pool's workers
+  class ScheduleAwaiter;
+  ScheduleAwaiter schedule();
+#endif
+  // Timers. The task is only added to the pool once it's due, so it doesn't
+  // hold up a worker while it waits. A periodic task is first added after one
+  // interval, and a run is skipped if the previous one is still going.
+  template <typename F>
+  TimerHandle addTaskAfter(Clock::duration delay, F function);
+  template <typename F>
+  TimerHandle addTaskAt(Clock::time_point time, F function);
+  template <typename F>
+  TimerHandle addPeriodicTask(Clock::duration interval, F function);
+  size_t pendingTimers() const;
+  // Log records dropped because a buffer was full, and writing out any that
+  // haven't been written yet (which waitUntilComplete also does)
+  uint64_t droppedLogMessages() const;
+  void flushLog();
+  void waitUntilComplete(bool allowNewTasks = true,
+                         bool abandonTasks  = false,
+                         bool terminatePool = false);
+  void reset();
+  void respawn();
+  void resize(size_t nThreads);
+  size_t workerCount() const;
+
+  // Queued (not yet running) tasks of each priority. Tasks queued on
+  // workers' own deques (when work stealing, or taken in a dequeueBatch)
+  // aren't included.
+  size_t queueDepth(size_t priority) const;
+  std::vector<size_t> queueDepths() const;
+
+  // NUMA nodes the pool keeps queues for (1 unless workers are placed), the
+  // node of a given worker, and the calling thread's worker index (if it's
+  // one of this pool's workers)
+  size_t nodeCount() const;
+  size_t workerNode(size_t worker) const;
+  std::optional<size_t> workerIndex() const;
+
+  // Instrumentation (only collected in HELPER_THREADPOOL_STATS builds). The
+  // trace is Chrome trace_event JSON, and should be written while the pool
+  // is idle (e.g. after waitUntilComplete) as events being recorded at the
+  // same time may come out garbled.
+  ThreadPoolStats stats() const;
+  void writeTrace(std::ostream& out) const;
+
+  // Parallel algorithms
+  template <typename Index, typename F>
+  void parallelFor(Index first, Index last, F function, size_t chunkSize = 0);
+  template <typename It, typename T, typename BinaryOp>
+  T parallelReduce(It first, It last, T init, BinaryOp op, size_t chunkSize = 0);
+  template <typename InIt, typename OutIt, typename UnaryOp>
+  OutIt parallelTransform(InIt first, InIt last, OutIt dFirst, UnaryOp op,
+                          size_t chunkSize = 0);
+  template <typename It, typename Compare = std::less<>>
+  void parallelSort(It first, It last, Compare comp = Compare(), size_t chunkSize = 0);
+
+private:
+  enum class WorkerState {
+    Stopped,   // No thread (or one that's been joined)
+    Running,
+    Retiring,  // Asked to exit by resize, once it's handed back its tasks
+    Exited     // The thread has finished, but hasn't been joined yet
+  };
+
+  // A worker slot. The pool has maxThreads of these from the start, so they
+  // never move while other workers are looking at them. The deque is only
+  // used with SchedulingMode::WorkStealing: the owner pushes and pops at the
+  // back, thieves pop from the front.
+  struct alignas(BoundedTaskQueue::kCacheLineSize) WorkerQueue {
+    std::mutex               mt;
+    TaskDeque                tasks;
+    std::atomic<WorkerState> state{WorkerState::Stopped};
+    std::atomic<uint64_t>    tasksRun{0};  // Only updated by the owner
+    std::vector<InlineTask>  batch;        // Only used by the owner, to dequeue
+  };
+
+  // Identifies the pool and worker (if any) running on the current thread
+  struct WorkerContext {
+    const ThreadPool* pool = nullptr;
+    size_t            id   = 0;
+  };
+
+  // The state shared by the runs of a periodic task
+  template <typename F>
+  struct PeriodicTask {
+    explicit PeriodicTask(F f) : function(std::move(f)) {}
+    F                 function;
+    std::atomic<bool> running{false};
+  };
+
+  // Wraps part of a parallel algorithm, which must run even if the pool drops
+  // it (QueueFullPolicy::Reject/DropOldest, or abandoning tasks): if it's
+  // destroyed without being run, it runs there and then.
+  template <typename F>
+  class MustRunTask {
+  public:
+    explicit MustRunTask(F function) : function_(std::move(function)) {}
+    MustRunTask(MustRunTask&& other) noexcept
+    : function_(std::move(other.function_)), pending_(other.pending_) {
+      other.pending_ = false;
+    }
+    ~MustRunTask() { if (pending_) (*this)(); }
+    void operator()() {
+      pending_ = false;
+      function_();
+    }
+  private:
+    F    function_;
+    bool pending_ = true;
+  };
+
+  // Keeps the first exception thrown by the chunks of a parallel algorithm
+  class FirstException {
+  public:
+    bool caught() const { return caught_; }
+    void capture() {
+      std::lock_guard<std::mutex> guard(mt_);
+      if (!error_)
+        error_ = std::current_exception();
+      caught_ = true;
+    }
+    void rethrow() const {
+      if (error_)
+        std::rethrow_exception(error_);
+    }
+  private:
+    std::atomic<bool>  caught_{false};
+    std::mutex         mt_;
+    std::exception_ptr error_;
+  };
+
+  std::ostream* log_;
+  SchedulingMode  scheduling_;
+  QueueFullPolicy fullPolicy_;
+  std::vector<std::thread> workers_ = {};    // One per slot in localTasks_
+  std::vector<std::unique_ptr<WorkerQueue>> localTasks_;
+  std::atomic<size_t> nWorkers_{0};          // Slots that are Running
+  size_t respawnWorkers_ = 0;                // nWorkers_ before terminating
+  std::mutex resizeMt_;                      // Serialises changes to the workers
+  bool autoscale_ = false;
+  size_t minThreads_ = 1;
+  Clock::duration targetQueueWait_{};
+  Clock::duration keepAlive_{};
+  std::thread autoscaler_;
+  std::mutex autoscaleMt_;
+  std::condition_variable autoscaleCv_;
+  bool stopAutoscaler_ = false;
+  TimerWheel timers_;                        // Guarded by timerMt_
+  mutable std::mutex timerMt_;
+  std::condition_variable timerCv_;
+  std::thread timerThread_;                  // Started by the first timer
+  bool stopTimers_ = false;
+  uint64_t timerWake_ = 0;                   // Tick the timer thread sleeps until
+  std::shared_ptr<TimerHandle::Owner> timerOwner_;  // Made by the first timer
+  // One log buffer per worker slot, plus one for other threads, drained by
+  // logThread_. Only used if there's a log stream. A slot's buffer is made
+  // (under logMt_) the first time a worker is started in it.
+  std::vector<std::unique_ptr<BoundedQueue<LogRecord>>> logs_;
+  size_t logCapacity_ = 256;
+  std::atomic<uint64_t> droppedLogs_{0};
+  uint64_t reportedDrops_ = 0;               // Guarded by logMt_
+  std::atomic<bool> logPending_{false};      // Set when there's something to write
+  std::mutex logMt_;                         // Held while writing to log_
+  std::mutex logWakeMt_;                     // Held to park or wake logThread_
+  std::condition_variable logCv_;
+  std::thread logThread_;
+  bool stopLog_ = false;                     // Guarded by logWakeMt_
+  Clock::time_point created_ = Clock::now();  // Tick 0 of the timers
+  Clock::duration timerResolution_ = std::chrono::milliseconds(1);
+  std::vector<std::unique_ptr<SharedTaskQueue>> tasks_;  // Shared/injection queue per node
+  std::vector<std::vector<int>> workerCpus_; // CPUs of worker i % size, if pinned
+  std::vector<size_t> workerNodes_;          // Node of worker i % size, if placed
+  bool pinWorkers_ = false;
+  std::atomic<size_t> nextNode_{0};          // Spreads unhinted tasks across nodes
+#if HELPER_THREADPOOL_STATS
+  // Counters for each worker, and a last set shared by other threads. Apart
+  // from that last set, only the owning worker updates them, so they don't
+  // contend.
+  struct TraceEvent {
+    std::atomic<uint64_t> start{0};  // Since epoch_
+    std::atomic<uint64_t> wait{0};
+    std::atomic<uint64_t> run{0};
+  };
+  struct AtomicHistogram {
+    std::unique_ptr<std::atomic<uint64_t>[]> counts{
+        new std::atomic<uint64_t>[LatencyHistogram::kBuckets]()};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> max{0};
+    void record(uint64_t value);
+    void addTo(LatencyHistogram& histogram) const;
+  };
+  struct alignas(BoundedTaskQueue::kCacheLineSize) WorkerStats {
+    std::atomic<uint64_t> tasksRun{0};
+    std::atomic<uint64_t> steals{0};
+    std::atomic<uint64_t> busyTime{0};
+    std::atomic<uint64_t> idleTime{0};
+    std::atomic<size_t>   queueHighWater{0};
+    AtomicHistogram       queueWait;
+    AtomicHistogram       runTime;
+    std::unique_ptr<TraceEvent[]> trace;
+    std::atomic<size_t>   nextEvent{0};
+  };
+  std::vector<std::unique_ptr<WorkerStats>> stats_;
+  Clock::time_point epoch_ = Clock::now();
+  size_t traceCapacity_ = 0;
+
+  WorkerStats& workerStats(size_t id) { return *stats_[std::min(id, stats_.size() - 1)]; }
+  void recordQueued(size_t depth);
+  void recordTask(size_t id, Clock::time_point queuedAt, Clock::time_point start,
+                  Clock::time_point end);
+#endif
+  std::atomic<size_t> queued_{0};            // Tasks in tasks_ and localTasks_
+  std::atomic<size_t> inFlight_{0};          // Tasks queued or running
+  std::atomic<size_t> idle_{0};              // Workers waiting on cv_
+  std::atomic<size_t> spinning_{0};          // Workers polling for tasks
+  IdlePolicy idlePolicy_ = IdlePolicy::Park;
+  size_t spinCount_  = 0;
+  size_t yieldCount_ = 0;
+  size_t dequeueBatch_ = 1;
+  std::mutex mt_;
+  std::condition_variable cv_;
+  std::mutex doneMt_;
+  std::condition_variable doneCv_;           // Signalled when inFlight_ hits 0
+  std::mutex notFullMt_;
+  std::condition_variable notFullCv_;        // Signalled when tasks_ has space
+  std::atomic<size_t> blockedProducers_{0};  // Threads waiting on notFullCv_
+  std::atomic<bool> allowNewTasks_{true};    // Is the ThreadPool accepting new tasks?
+  bool terminate_ = false;  // Should the ThreadPool terminate when it can?
+
+  bool pushTask(InlineTask&& task, bool tryOnly = false,
+                const TaskHints& hints = TaskHints());
+  bool pushShared(InlineTask& task, bool tryOnly, const TaskHints& hints);
+  bool tryPushShared(InlineTask& task, size_t node, const TaskHints& hints);
+  bool popShared(size_t node, InlineTask& task);
+  bool popSharedBatch(size_t node, size_t id, InlineTask& task);
+  void pushTasks(std::vector<InlineTask>& tasks);
+  size_t targetNode(const TaskHints& hints);
+  void wakeWorker();
+  void wakeWorkers(size_t n);
+  void taskDone(size_t count = 1);
+  void placeWorkers(const ThreadPoolOptions& options);
+  void spawnWorkers(size_t nThreads, size_t maxThreads);
+  void resizeLocked(size_t nThreads);
+  bool startWorker(size_t id);
+  bool retireWorker(size_t id);
+  bool retireIdleWorker(size_t id);
+  void reapWorkers();
+  void pinWorker(std::thread& worker, size_t id);
+  void startAutoscaler();
+  void stopAutoscaler();
+  void autoscale();
+  uint64_t tasksStarted() const;
+  TimerHandle addTimer(Clock::time_point time, InlineTask&& task,
+                       Clock::duration interval = Clock::duration::zero(),
+                       std::function<InlineTask()> makeTask = nullptr);
+  bool cancelTimer(TimerWheel::Id id);
+  void runTimers();
+  void startLogThread();
+  void stopLogThread();
+  void writeLog();
+  void stopTimers();
+  uint64_t timerTick(Clock::time_point time) const;
+  bool popTask(size_t id, InlineTask& task);
+  bool stealTask(size_t id, InlineTask& task);
+  bool runPendingTask();
+  void runTask(InlineTask& task, size_t id);
+  void clearTasks();
+  size_t defaultChunkSize(size_t n) const;
+  template <typename F>
+  void forEachChunk(size_t n, size_t chunkSize, F body);
+  template <typename F>
+  void splitChunks(TaskGroup& group, size_t first, size_t last, F& runChunk);
+  template <typename It, typename Compare>
+  void sortRange(TaskGroup& group, It first, It last, Compare& comp,
+                 size_t chunkSize, FirstException& error);
+  void logMessage(LogSeverity severity, const char* message, const char* detail = "",
+                  size_t worker = LogRecord::kNoWorker);
+  static WorkerContext& currentWorker();
+  static void cpuRelax();
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// ThreadPoolWorker
+//   An auxiliary class used for thread pooling. This is based off Jakob
+//   Progsch's C++11 Worker Class (accessible here: http://progsch.net/wordpress/?p=81)
+//   but with changes made for readability, logging, and to allow us to wait for
+//   all threads to complete before terminating.
+//
+//   This class is not intended to be used separately from ThreadPool - for
+//   guidance on how to use the ThreadPool class, please look at ThreadPool.h
+////////////////////////////////////////////////////////////////////////////////
+class ThreadPoolWorker {
+public:
+  explicit ThreadPoolWorker(ThreadPool& tp, size_t id);
+  void operator()();
+
+private:
+  ThreadPool& tp_;
+  size_t      id_;
+  size_t      spinBudget_;
+
+  bool spinForTask();
+#if HELPER_THREADPOOL_STATS
+  void recordIdle(ThreadPool::Clock::time_point start);
+#endif
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// TaskGroup
+//   A scoped set of tasks run on a ThreadPool. Unlike
+//   ThreadPool::waitUntilComplete, TaskGroup::wait only waits for the tasks
+//   added through this group, so several callers can share a pool without
+//   waiting on each other's work. The destructor waits for any tasks that are
+//   still outstanding.
+//
+//   Usage:
+//       TaskGroup group(thread_pool);
+//       for (int i=0 ; i<20 ; i++)
+//         group.addTask([i]() { fnc_with_side_effect(i); });
+//       group.wait();
+//
+//   While waiting, the calling thread runs queued tasks from the pool (not
+//   just those in the group), so groups can safely be waited on from inside
+//   a task. addTask returns false if the pool isn't accepting new tasks.
+////////////////////////////////////////////////////////////////////////////////
+class TaskGroup {
+public:
+  explicit TaskGroup(ThreadPool& pool);
+  ~TaskGroup();
+
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+
+  template <typename F>
+  bool addTask(F function);
+  void wait();
+
+private:
+  ThreadPool&         pool_;
+  std::atomic<size_t> pending_{0};
+  std::mutex              mt_;
+  std::condition_variable cv_;
+
+  // Reports a task as done when destroyed, whether or not it was run
+  struct DoneToken {
+    TaskGroup* group;
+    explicit DoneToken(TaskGroup* g) : group(g) {}
+    DoneToken(DoneToken&& other) noexcept : group(other.group) { other.group = nullptr; }
+    ~DoneToken() { if (group) group->taskDone(); }
+  };
+
+  // The task handed to the pool. The token is declared first so that it's
+  // destroyed last, after anything the function does in its own destructor.
+  template <typename F>
+  struct GroupTask {
+    DoneToken token;
+    F         function;
+    void operator()() { function(); }
+  };
+
+  void taskDone();
+};
+
+////////////////////////////////////////////////////////////////////////////////
+ThreadPool::ThreadPool(size_t nThreads, std::ostream* logStream)
+: log_(logStream),
+  scheduling_(SchedulingMode::SharedQueue),
+  fullPolicy_(QueueFullPolicy::Block) {
+  tasks_.push_back(std::make_unique<SharedTaskQueue>(ThreadPoolOptions()));
+  spawnWorkers(nThreads, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+ThreadPool::ThreadPool(const ThreadPoolOptions& options, std::ostream* logStream)
+: log_(logStream),
+  scheduling_(options.scheduling),
+  fullPolicy_(options.fullPolicy),
+  autoscale_(options.autoscale),
+  minThreads_(std::max<size_t>(1, options.minThreads)),
+  targetQueueWait_(options.targetQueueWait),
+  keepAlive_(options.keepAlive),
+  logCapacity_(options.logCapacity),
+  timerResolution_(std::max<Clock::duration>(options.timerResolution, Clock::duration(1))),
+  // Polling on a single CPU just keeps the thread we're waiting for off it
+  idlePolicy_(std::thread::hardware_concurrency() > 1 ? options.idlePolicy : IdlePolicy::Park),
+  spinCount_(options.spinCount),
+  yieldCount_(options.yieldCount),
+  dequeueBatch_(std::max<size_t>(1, options.dequeueBatch)) {
+#if HELPER_THREADPOOL_STATS
+  traceCapacity_ = options.traceCapacity;
+#endif
+  placeWorkers(options);
+  spawnWorkers(options.nThreads, options.maxThreads);
+  startAutoscaler();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+ThreadPool::~ThreadPool() {
+  // Handles to our timers may outlive us, so cut them off first
+  if (timerOwner_) {
+    std::lock_guard<std::mutex> guard(timerOwner_->mt);
+    timerOwner_->pool = nullptr;
+  }
+  waitUntilComplete(false, true, true);
+  stopLogThread();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename F>
+void ThreadPool::addTask(F function) {
+  pushTask(InlineTask(std::move(function)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename F>
+void ThreadPool::addTask(F function, size_t priority) {
+  pushTask(InlineTask(std::move(function)), false, TaskHints{ priority });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename F>
+void ThreadPool::addTask(F function, Clock::time_point deadline) {
+  TaskHints hints;
+  hints.deadline = deadline;
+  pushTask(InlineTask(std::move(function)), false, hints);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename F>
+void ThreadPool::addTask(F function, NodeHint node) {
+  TaskHints hints;
+  hints.node = node.node;
+  pushTask(InlineTask(std::move(function)), false, hints);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename It>
+void ThreadPool::addTasks(It first, It last) {
+  std::vector<InlineTask> tasks;
+  if (std::is_base_of<std::forward_iterator_tag,
+                      typename std::iterator_traits<It>::iterator_category>::value)
+    tasks.reserve(std::distance(first, last));
+  for (; first != last; ++first)
+    tasks.emplace_back(*first);
+  pushTasks(tasks);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename F>
+bool ThreadPool::tryAddTask(F function) {
+  return pushTask(InlineTask(std::move(function)), true);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename F>
+bool ThreadPool::tryAddTask(F function, size_t priority) {
+  return pushTask(InlineTask(std::move(function)), true, TaskHints{ priority });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename F, typename... Args>
+TaskFuture<std::invoke_result_t<F, Args...>> ThreadPool::submit(F function, Args... args) {
+  using R = std::invoke_result_t<F, Args...>;
+  TaskState<R>* state = TaskState<R>::acquire();
+  TaskFuture<R> future(state);
+  // If the pool rejects the task, destroying it hands the future an error
+  pushTask(InlineTask(SubmittedTask<R, F, Args...>(state, std::move(function),
+                                                   std::move(args)...)));
+  return future;
+}
+
+#if HELPER_THREADPOOL_COROUTINES
+////////////////////////////////////////////////////////////////////////////////
+// ThreadPool::ScheduleAwaiter
+//   Returned by ThreadPool::schedule. Awaiting it queues the coroutine's handle
+//   as an ordinary task (it fits in InlineTask's buffer, so nothing is
+//   allocated), and the worker that picks it up resumes the coroutine. If the
+//   pool drops the task the coroutine is resumed by whoever dropped it, like
+//   the chunks of the parallel algorithms, so it's never left suspended.
+////////////////////////////////////////////////////////////////////////////////
+class ThreadPool::ScheduleAwaiter {
+public:
+  explicit ScheduleAwaiter(ThreadPool& pool) : pool_(pool) {}
+  bool await_ready() const noexcept { return false; }
+  void await_suspend(std::coroutine_handle<> handle) {
+    auto resume = [handle]() { handle.resume(); };
+    pool_.addTask(MustRunTask<decltype(resume)>(resume));
+  }
+  void await_resume() const noexcept {}
+private:
+  ThreadPool& pool_;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+ThreadPool::ScheduleAwaiter ThreadPool::schedule() {
+  return ScheduleAwaiter(*this);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename F>
+TimerHandle ThreadPool::addTaskAfter(Clock::duration delay, F function) {
+  return addTimer(Clock::now() + delay, InlineTask(std::move(function)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename F>
+TimerHandle ThreadPool::addTaskAt(Clock::time_point time, F function) {
+  return addTimer(time, InlineTask(std::move(function)));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename F>
+TimerHandle ThreadPool::addPeriodicTask(Clock::duration interval, F function) {
+  if (interval <= Clock::duration::zero())
+    throw std::logic_error("ThreadPool::addPeriodicTask : The interval must be positive.");
+  auto periodic = std::make_shared<PeriodicTask<F>>(std::move(function));
+  auto makeTask = [periodic]() {
+    return InlineTask([periodic]() {
+      if (periodic->running.exchange(true, std::memory_order_acquire))
+        return;  // The last run hasn't finished
+      struct Finish {
+        std::atomic<bool>& running;
+        ~Finish() { running.store(false, std::memory_order_release); }
+      } finish{ periodic->running };
+      periodic->function();
+    });
+  };
+  return addTimer(Clock::now() + interval, InlineTask(), interval, makeTask);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// template <typename F>
+// void ThreadPool::addTask(F function)
+// // Declared in the header file to allow for template matching
+
+////////////////////////////////////////////////////////////////////////////////
+bool ThreadPool::pushTask(InlineTask&& task, bool tryOnly, const TaskHints& hints) {
+  if (!allowNewTasks_) {
+    if (!tryOnly)
+      logMessage(LogSeverity::Error,
+                 "ThreadPool::addTask : Attempting to add task to a stopped thread pool.");
+    return false;
+  }
+  // Count the task as in flight before it becomes visible to the workers, so
+  // inFlight_ can never drop to zero while it's queued
+  ++inFlight_;
+#if HELPER_THREADPOOL_STATS
+  task.queuedAt = Clock::now();
+#endif
+  const WorkerContext& context = currentWorker();
+  if (scheduling_ == SchedulingMode::WorkStealing && context.pool == this &&
+      hints.priority == SharedTaskQueue::kDefaultPriority &&
+      hints.deadline == SharedTaskQueue::kNoDeadline &&
+      (hints.node == TaskHints::kAnyNode || hints.node == workerNode(context.id))) {
+    // Called from one of our own workers, so push onto its local deque without
+    // touching the shared queue. We only need mt_ if a worker may be asleep.
+    WorkerQueue& local = *localTasks_[context.id];
+    {
+      std::lock_guard<std::mutex> guard(local.mt);
+      local.tasks.push_back(std::move(task));
+      ++queued_;
+    }
+#if HELPER_THREADPOOL_STATS
+    recordQueued(queued_);
+#endif
+    wakeWorker();
+    return true;
+  }
+  return pushShared(task, tryOnly, hints);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::pushTasks(std::vector<InlineTask>& tasks) {
+  if (tasks.empty())
+    return;
+  if (!allowNewTasks_) {
+    logMessage(LogSeverity::Error,
+               "ThreadPool::addTasks : Attempting to add tasks to a stopped thread pool.");
+    return;
+  }
+  const size_t n = tasks.size();
+  inFlight_ += n;
+#if HELPER_THREADPOOL_STATS
+  const Clock::time_point now = Clock::now();
+  for (InlineTask& task : tasks)
+    task.queuedAt = now;
+#endif
+  const WorkerContext& context = currentWorker();
+  if (scheduling_ == SchedulingMode::WorkStealing && context.pool == this) {
+    // As in pushTask, a worker's tasks go onto its own deque
+    WorkerQueue& local = *localTasks_[context.id];
+    {
+      std::lock_guard<std::mutex> guard(local.mt);
+      for (InlineTask& task : tasks)
+        local.tasks.push_back(std::move(task));
+      queued_ += n;
+    }
+#if HELPER_THREADPOOL_STATS
+    recordQueued(queued_);
+#endif
+    wakeWorkers(n);
+    return;
+  }
+
+  // Other threads' batches are split evenly between the nodes' queues
+  const size_t nNodes = (context.pool == this) ? 1 : tasks_.size();
+  const size_t start  = targetNode(TaskHints());
+  size_t pushed = 0;
+  for (size_t i = 0; i < nNodes; i++) {
+    const size_t first = n * i / nNodes, last = n * (i + 1) / nNodes;
+    if (first == last)
+      continue;
+    TaskHints hints;
+    hints.node = (start + i) % tasks_.size();
+    // Count the tasks as queued before they're visible, as in tryPushShared
+    const size_t depth = (queued_ += last - first);
+    const size_t count = tasks_[hints.node]->tryPushMany(
+        &tasks[first], last - first, hints.priority, hints.deadline);
+    queued_ -= (last - first) - count;
+#if HELPER_THREADPOOL_STATS
+    recordQueued(depth);
+#else
+    (void)depth;
+#endif
+    pushed += count;
+    // Whatever didn't fit goes through the queue-full policy one at a time
+    for (size_t j = first + count; j < last; j++)
+      pushShared(tasks[j], false, hints);
+  }
+  wakeWorkers(pushed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool ThreadPool::pushShared(InlineTask& task, bool tryOnly, const TaskHints& hints) {
+  const size_t node = targetNode(hints);
+  while (!tryPushShared(task, node, hints)) {
+    // Blocking a worker on a full queue could leave nobody to empty it, so
+    // workers always run the task themselves instead
+    QueueFullPolicy policy = fullPolicy_;
+    if (policy == QueueFullPolicy::Block && currentWorker().pool == this)
+      policy = QueueFullPolicy::CallerRuns;
+
+    if (tryOnly || policy == QueueFullPolicy::Reject) {
+      if (!tryOnly)
+        logMessage(LogSeverity::Error,
+                   "ThreadPool::addTask : Task queue is full, so the task has been dropped.");
+      taskDone();
+      return false;  // Destroying the task lets any TaskFuture/TaskGroup know
+    }
+    if (policy == QueueFullPolicy::CallerRuns) {
+      runTask(task, localTasks_.size());
+      return true;
+    }
+    if (policy == QueueFullPolicy::DropOldest) {
+      InlineTask oldest;
+      if (tasks_[node]->tryPopOldest(oldest, hints.priority)) {
+        --queued_;
+        oldest.reset();
+        taskDone();
+      }
+      continue;
+    }
+    // QueueFullPolicy::Block - re-check for space after registering as blocked,
+    // so a worker either sees us waiting or we see the slot it freed
+    std::unique_lock<std::mutex> lock(notFullMt_);
+    ++blockedProducers_;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const bool pushed = tryPushShared(task, node, hints);
+    if (!pushed)
+      notFullCv_.wait(lock);
+    --blockedProducers_;
+    if (pushed)
+      break;
+  }
+  wakeWorker();
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool ThreadPool::tryPushShared(InlineTask& task, size_t node, const TaskHints& hints) {
+  // Count the task as queued before it's visible to the workers, so queued_
+  // never under-counts (a worker may briefly see a task that isn't there yet)
+  const size_t depth = ++queued_;
+  if (tasks_[node]->tryPush(task, hints.priority, hints.deadline)) {
+#if HELPER_THREADPOOL_STATS
+    recordQueued(depth);
+#else
+    (void)depth;
+#endif
+    return true;
+  }
+  --queued_;
+  return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool ThreadPool::popShared(size_t node, InlineTask& task) {
+  if (!tasks_[node]->tryPop(task))
+    return false;
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (blockedProducers_ > 0) {
+    // With several nodes the producer we wake must be one waiting on this
+    // node's queue, so wake them all
+    { std::lock_guard<std::mutex> guard(notFullMt_); }
+    if (tasks_.size() == 1)
+      notFullCv_.notify_one();
+    else
+      notFullCv_.notify_all();
+  }
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool ThreadPool::popSharedBatch(size_t node, size_t id, InlineTask& task) {
+  // Take no more than our share of what's queued, so that we don't hold on to
+  // tasks that idle workers could be running
+  size_t max = 1;
+  if (dequeueBatch_ > 1 && id < localTasks_.size())
+    max = std::min(dequeueBatch_, queued_ / std::max<size_t>(1, nWorkers_));
+  if (max <= 1)
+    return popShared(node, task);
+
+  WorkerQueue& local = *localTasks_[id];
+  if (local.batch.size() < max)
+    local.batch.resize(dequeueBatch_);
+  const size_t n = tasks_[node]->tryPopMany(local.batch.data(), max);
+  if (n == 0)
+    return false;
+  task = std::move(local.batch[0]);
+  if (n > 1) {
+    // Newest first, so popping from the back of the deque keeps them in order
+    std::lock_guard<std::mutex> guard(local.mt);
+    for (size_t i = n - 1; i > 0; i--)
+      local.tasks.push_back(std::move(local.batch[i]));
+  }
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+size_t ThreadPool::targetNode(const TaskHints& hints) {
+  if (tasks_.size() == 1)
+    return 0;
+  if (hints.node != TaskHints::kAnyNode)
+    return hints.node % tasks_.size();
+  const WorkerContext& context = currentWorker();
+  if (context.pool == this)
+    return workerNode(context.id);
+  return nextNode_++ % tasks_.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::wakeWorker() {
+  wakeWorkers(1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::wakeWorkers(size_t n) {
+  // Workers that are spinning will find tasks by themselves, so only wake one
+  // parked worker for each task beyond those
+  const size_t idle = idle_, queued = queued_, spinning = spinning_;
+  if (idle == 0 || queued <= spinning)
+    return;
+  const size_t wake = std::min(n, std::min(idle, queued - spinning));
+  // Taking mt_ ensures a worker that has just seen queued_ == 0 is already
+  // waiting on cv_ and so receives the notification
+  { std::lock_guard<std::mutex> guard(mt_); }
+  if (wake >= idle) {
+    cv_.notify_all();
+  } else {
+    for (size_t i = 0; i < wake; i++)
+      cv_.notify_one();
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::waitUntilComplete(bool allowNewTasks,
+                                   bool abandonTasks,
+                                   bool terminatePool) {
+  if (allowNewTasks && (abandonTasks || terminatePool))
+    throw std::logic_error("ThreadPool::waitUntilComplete : "
+                           "allowNewTasks is incompatible with abandonTasks "
+                           "and terminatePool.");
+
+  allowNewTasks_ = allowNewTasks;
+
+  if (terminatePool)
+    stopTimers();
+  if (abandonTasks) {
+    // We're abandoning tasks (and not allowing new ones), so ditch the task
+    // queue and any timers that haven't fired
+    {
+      std::lock_guard<std::mutex> guard(timerMt_);
+      timers_.clear();
+    }
+    clearTasks();
+  }
+  // Wait until every queued and running task has completed. If new tasks are
+  // allowed then any tasks they add are waited for too.
+  {
+    std::unique_lock<std::mutex> lock(doneMt_);
+    doneCv_.wait(lock, [this]() { return inFlight_ == 0; });
+  }
+  if (terminatePool) {
+    // There are no more tasks on the queue, so notify each thread and join
+    stopAutoscaler();
+    std::lock_guard<std::mutex> resizeGuard(resizeMt_);
+    {
+      std::lock_guard<std::mutex> guard(mt_);
+      if (!terminate_)
+        respawnWorkers_ = nWorkers_;
+      terminate_ = true;
+    }
+    cv_.notify_all();
+    for (size_t i = 0; i < workers_.size(); i++) {
+      if (workers_[i].joinable())
+        workers_[i].join();
+      localTasks_[i]->state = WorkerState::Stopped;
+    }
+    nWorkers_ = 0;
+  } else {
+    // We're done, so allow new tasks again
+    allowNewTasks_ = true;
+  }
+  flushLog();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+size_t ThreadPool::pendingTimers() const {
+  std::lock_guard<std::mutex> guard(timerMt_);
+  return timers_.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TimerHandle ThreadPool::addTimer(Clock::time_point time, InlineTask&& task,
+                                 Clock::duration interval,
+                                 std::function<InlineTask()> makeTask) {
+  std::lock_guard<std::mutex> guard(timerMt_);
+  if (!timerThread_.joinable()) {
+    stopTimers_ = false;
+    timerThread_ = std::thread([this]() { runTimers(); });
+  }
+  if (!timerOwner_) {
+    timerOwner_ = std::make_shared<TimerHandle::Owner>();
+    timerOwner_->pool = this;
+  }
+  const uint64_t due = timerTick(time);
+  TimerWheel::Id id;
+  if (makeTask) {
+    const uint64_t ticks = (interval + timerResolution_ - Clock::duration(1)) / timerResolution_;
+    id = timers_.addPeriodic(due, ticks, std::move(makeTask));
+  } else {
+    id = timers_.add(due, std::move(task));
+  }
+  // Only wake the timer thread if it would otherwise sleep past this timer
+  if (due < timerWake_) {
+    timerWake_ = due;
+    timerCv_.notify_one();
+  }
+  return TimerHandle(timerOwner_, id);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool ThreadPool::cancelTimer(TimerWheel::Id id) {
+  std::lock_guard<std::mutex> guard(timerMt_);
+  return timers_.cancel(id);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::runTimers() {
+  std::vector<InlineTask> due;
+  std::unique_lock<std::mutex> lock(timerMt_);
+  while (!stopTimers_) {
+    // Only ticks that have passed completely, so nothing fires early
+    timers_.advance((Clock::now() - created_) / timerResolution_, due);
+    if (!due.empty()) {
+      // Add the due tasks without holding up anyone adding timers
+      lock.unlock();
+      for (auto& task : due)
+        pushTask(std::move(task));
+      due.clear();
+      lock.lock();
+      continue;
+    }
+    std::optional<uint64_t> next = timers_.nextTick();
+    if (next) {
+      timerWake_ = *next;
+      timerCv_.wait_until(lock, created_ + *next * timerResolution_);
+    } else {
+      timerWake_ = UINT64_MAX;
+      timerCv_.wait(lock);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::stopTimers() {
+  {
+    std::lock_guard<std::mutex> guard(timerMt_);
+    stopTimers_ = true;
+    timers_.clear();
+  }
+  timerCv_.notify_all();
+  if (timerThread_.joinable())
+    timerThread_.join();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+uint64_t ThreadPool::timerTick(Clock::time_point time) const {
+  // Round up, so a timer never fires early
+  if (time <= created_)
+    return 0;
+  return static_cast<uint64_t>((time - created_ + timerResolution_ - Clock::duration(1))
+                               / timerResolution_);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool TimerHandle::cancel() {
+  if (!owner_)
+    return false;
+  std::lock_guard<std::mutex> guard(owner_->mt);
+  return owner_->pool != nullptr && owner_->pool->cancelTimer(id_);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::taskDone(size_t count) {
+  if (count == 0 || inFlight_.fetch_sub(count) != count)
+    return;
+  // Taking doneMt_ ensures a waiter that has just seen inFlight_ != 0 is
+  // already waiting on doneCv_ and so receives the notification
+  { std::lock_guard<std::mutex> guard(doneMt_); }
+  doneCv_.notify_all();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::placeWorkers(const ThreadPoolOptions& options) {
+  size_t nNodes = 1;
+  if (options.placement != WorkerPlacement::None) {
+    const CpuTopology topology = options.topology.empty() ? CpuTopology::detect()
+                                                          : options.topology;
+    if (options.placement == WorkerPlacement::CpuSets) {
+      workerCpus_ = options.cpuSets;
+    } else if (options.placement == WorkerPlacement::PhysicalCores) {
+      workerCpus_ = topology.physicalCores();
+    } else {
+      for (size_t node = 0; node < topology.nodeCount(); node++)
+        workerCpus_.push_back(topology.nodeCpus(node));
+    }
+    workerCpus_.erase(std::remove_if(workerCpus_.begin(), workerCpus_.end(),
+                                     [](const std::vector<int>& cpus) { return cpus.empty(); }),
+                      workerCpus_.end());
+    if (workerCpus_.empty())
+      throw std::logic_error("ThreadPool::ThreadPool : "
+                             "There are no CPUs to place the workers on.");
+    for (const auto& cpus : workerCpus_)
+      workerNodes_.push_back(topology.nodeOf(cpus.front()));
+    pinWorkers_ = options.pinWorkers;
+    nNodes = topology.nodeCount();
+  }
+  for (size_t node = 0; node < nNodes; node++)
+    tasks_.push_back(std::make_unique<SharedTaskQueue>(options));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::spawnWorkers(size_t nThreads, size_t maxThreads) {
+  if (maxThreads == 0)
+    maxThreads = 2 * std::max(1u, std::thread::hardware_concurrency());
+  maxThreads = std::max(maxThreads, nThreads);
+  workers_.resize(maxThreads);
+  localTasks_.reserve(maxThreads);
+  for (size_t i = 0; i < maxThreads; i++)
+    localTasks_.push_back(std::make_unique<WorkerQueue>());
+#if HELPER_THREADPOOL_STATS
+  // One for each worker, plus one for threads outside the pool
+  for (size_t i = 0; i <= maxThreads; i++) {
+    stats_.push_back(std::make_unique<WorkerStats>());
+    if (traceCapacity_ > 0)
+      stats_.back()->trace.reset(new TraceEvent[traceCapacity_]);
+  }
+#endif
+  if (log_ != nullptr) {
+    logs_.resize(maxThreads + 1);
+    logs_.back() = std::make_unique<BoundedQueue<LogRecord>>(logCapacity_);
+    startLogThread();
+  }
+  // Only start the workers once every local deque exists, as any worker may
+  // try to steal from any other
+  std::lock_guard<std::mutex> guard(resizeMt_);
+  resizeLocked(nThreads);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::resize(size_t nThreads) {
+  if (nThreads == 0 || nThreads > localTasks_.size())
+    throw std::logic_error("ThreadPool::resize : nThreads must be between 1 and "
+                           "ThreadPoolOptions::maxThreads.");
+  std::lock_guard<std::mutex> resizeGuard(resizeMt_);
+  {
+    std::lock_guard<std::mutex> guard(mt_);
+    if (terminate_)
+      throw std::logic_error("ThreadPool::resize : The pool has been terminated. "
+                             "Call respawn first.");
+  }
+  resizeLocked(nThreads);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+size_t ThreadPool::workerCount() const {
+  return nWorkers_;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::reset() {
+  // Abandon the queued tasks, and once the running ones finish carry on as
+  // normal
+  waitUntilComplete(false, true, false);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::respawn() {
+  {
+    std::lock_guard<std::mutex> resizeGuard(resizeMt_);
+    {
+      std::lock_guard<std::mutex> guard(mt_);
+      if (!terminate_)
+        return;  // Still running
+      terminate_ = false;
+    }
+    allowNewTasks_ = true;
+    resizeLocked(respawnWorkers_);
+  }
+  startAutoscaler();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::resizeLocked(size_t nThreads) {
+  // Retire the highest numbered workers first, and start the lowest numbered
+  // slots first. Workers are retired by asking them to exit, as they may be in
+  // the middle of a task (or this may be one of them).
+  for (size_t i = localTasks_.size(); i-- > 0 && nWorkers_ > nThreads;) {
+    WorkerState expected = WorkerState::Running;
+    if (localTasks_[i]->state.compare_exchange_strong(expected, WorkerState::Retiring))
+      --nWorkers_;
+  }
+  for (size_t i = 0; i < localTasks_.size() && nWorkers_ < nThreads; i++) {
+    if (startWorker(i))
+      ++nWorkers_;
+  }
+  reapWorkers();
+  // Wake up any parked workers we've just retired
+  { std::lock_guard<std::mutex> guard(mt_); }
+  cv_.notify_all();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool ThreadPool::startWorker(size_t id) {
+  WorkerQueue& slot = *localTasks_[id];
+  WorkerState state = slot.state;
+  if (state == WorkerState::Running)
+    return false;
+  // A retiring worker that hasn't left yet can just carry on
+  if (state == WorkerState::Retiring &&
+      slot.state.compare_exchange_strong(state, WorkerState::Running))
+    return true;
+  if (workers_[id].joinable())
+    workers_[id].join();
+  if (log_ != nullptr && !logs_[id]) {
+    std::lock_guard<std::mutex> guard(logMt_);
+    logs_[id] = std::make_unique<BoundedQueue<LogRecord>>(logCapacity_);
+  }
+  slot.state = WorkerState::Running;
+  workers_[id] = std::thread(ThreadPoolWorker(*this, id));
+  if (pinWorkers_)
+    pinWorker(workers_[id], id);
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+bool ThreadPool::retireWorker(size_t id) {
+  // Hand anything left on our deque back to the pool, so no task is lost. If
+  // the shared queue is full we run the task ourselves rather than drop it.
+  // Tasks we run here may add more to our deque, so keep going until it's empty.
+  WorkerQueue& slot = *localTasks_[id];
+  while (1) {
+    TaskDeque tasks;
+    {
+      std::lock_guard<std::mutex> guard(slot.mt);
+      std::swap(tasks, slot.tasks);
+    }
+    if (tasks.empty())
+      break;
+    while (!tasks.empty()) {
+      // The task is counted again as it's pushed, so queued_ never drops to
+      // zero while it's moving
+      InlineTask task = tasks.pop_front();
+      const bool moved = tryPushShared(task, workerNode(id), TaskHints());
+      --queued_;
+      if (moved)
+        wakeWorker();
+      else
+        runTask(task, id);
+    }
+  }
+  // We may have been asked to keep going in the meantime
+  WorkerState expected = WorkerState::Retiring;
+  return slot.state.compare_exchange_strong(expected, WorkerState::Exited);
+}
 
-namespace helper {
+////////////////////////////////////////////////////////////////////////////////
+bool ThreadPool::retireIdleWorker(size_t id) {
+  {
+    // Don't hold up a resize, we can always try again later
+    std::unique_lock<std::mutex> lock(resizeMt_, std::try_to_lock);
+    if (!lock.owns_lock() || nWorkers_ <= minThreads_)
+      return false;
+    WorkerState expected = WorkerState::Running;
+    if (!localTasks_[id]->state.compare_exchange_strong(expected, WorkerState::Retiring))
+      return false;
+    --nWorkers_;
+  }
+  return retireWorker(id);
+}
 
 ////////////////////////////////////////////////////////////////////////////////
-// ThreadPool
-//   This class allows you to define a pool of N threads that can be used to run
-//   functions operations stored in a queue. This is based off Jakob Progsch's
-//   C++11 Thread Pool (accessible here: http://progsch.net/wordpress/?p=81) but
-//   with changes made for readability, logging, and to allow us to wait for all
-//   threads to complete before terminating.
-//
-//   Usage of this class should be fairly self-explanatory, as follows:
-//       ThreadPool thread_pool(NUM_THREADS, &std::cerr);
-//       for (int i=0 ; i<20 ; i++)
-//         thread_pool.addTask([i]() { fnc_with_side_effect(i); });
-//       thread_pool.waitUntilComplete(true);
-//
-//   Note the dependency on ThreadPoolWorker.h
+void ThreadPool::reapWorkers() {
+  // Join the threads of workers that have exited. None of them can be us.
+  for (size_t i = 0; i < localTasks_.size(); i++) {
+    if (localTasks_[i]->state == WorkerState::Exited) {
+      workers_[i].join();
+      localTasks_[i]->state = WorkerState::Stopped;
+    }
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
-class ThreadPool {
-public:
-  friend class ThreadPoolWorker;
+void ThreadPool::startAutoscaler() {
+  if (!autoscale_)
+    return;
+  stopAutoscaler_ = false;
+  autoscaler_ = std::thread([this]() { autoscale(); });
+}
 
-public:
-  explicit ThreadPool(size_t nThreads = 4,
-                      std::ostream* logStream = nullptr);
-  ~ThreadPool();
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::stopAutoscaler() {
+  {
+    std::lock_guard<std::mutex> guard(autoscaleMt_);
+    stopAutoscaler_ = true;
+  }
+  autoscaleCv_.notify_all();
+  if (autoscaler_.joinable())
+    autoscaler_.join();
+}
 
-  template <typename F>
-  void addTask(F function);
-  void waitUntilComplete(bool allowNewTasks = true,
-                         bool abandonTasks  = false,
-                         bool terminatePool = false);
-  void reset();
-  void respawn();
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::autoscale() {
+  const Clock::duration interval = std::clamp<Clock::duration>(
+      targetQueueWait_, std::chrono::milliseconds(1), std::chrono::milliseconds(100));
+  uint64_t          lastStarted = tasksStarted();
+  Clock::time_point lastCheck   = Clock::now();
 
-private:
-  std::ostream* log_;
-  std::vector<std::thread> workers_ = {};
-  std::vector<char>        working_;
-  std::queue<std::function<void()>> tasks_;
-  std::mutex mt_;
-  std::condition_variable cv_;
-  bool allowNewTasks_ = true;   // Is the ThreadPool accepting new tasks?
-  bool terminate_     = false;  // Should the ThreadPool terminate when it can?
+  std::unique_lock<std::mutex> lock(autoscaleMt_);
+  while (!autoscaleCv_.wait_for(lock, interval, [this]() { return stopAutoscaler_; })) {
+    const uint64_t          started = tasksStarted();
+    const Clock::time_point now     = Clock::now();
+    const size_t            queued  = queued_;
+    // By Little's law a new task waits about as long as the workers take to
+    // start the tasks queued ahead of it, at the rate they've been starting
+    // them since the last check
+    bool tooSlow = false;
+    if (queued > 0) {
+      const double elapsed = std::chrono::duration<double>(now - lastCheck).count();
+      const double wait    = (started > lastStarted) ? elapsed * queued / (started - lastStarted)
+                                                     : elapsed;
+      tooSlow = (wait > std::chrono::duration<double>(targetQueueWait_).count());
+    }
+    {
+      std::lock_guard<std::mutex> guard(resizeMt_);
+      if (tooSlow && nWorkers_ < localTasks_.size())
+        resizeLocked(nWorkers_ + 1);
+      else
+        reapWorkers();
+    }
+    lastStarted = started;
+    lastCheck   = now;
+  }
+}
 
-  void logMessage(const std::string& msg);
-};
+////////////////////////////////////////////////////////////////////////////////
+uint64_t ThreadPool::tasksStarted() const {
+  uint64_t started = 0;
+  for (const auto& slot : localTasks_)
+    started += slot->tasksRun.load(std::memory_order_relaxed);
+  return started;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
-// ThreadPoolWorker
-//   An auxiliary class used for thread pooling. This is based off Jakob
-//   Progsch's C++11 Worker Class (accessible here: http://progsch.net/wordpress/?p=81)
-//   but with changes made for readability, logging, and to allow us to wait for
-//   all threads to complete before terminating.
-//
-//   This class is not intended to be used separately from ThreadPool - for
-//   guidance on how to use the ThreadPool class, please look at ThreadPool.h
+void ThreadPool::pinWorker(std::thread& worker, size_t id) {
+  const std::vector<int>& cpus = workerCpus_[id % workerCpus_.size()];
+#if defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE)
+      CPU_SET(cpu, &set);
+  }
+  const int error = pthread_setaffinity_np(worker.native_handle(), sizeof(set), &set);
+  if (error != 0)
+    logMessage(LogSeverity::Error, "ThreadPool::ThreadPool : Unable to pin the worker to "
+               "its CPUs, so continuing without pinning it. Error ",
+               std::to_string(error).c_str(), id);
+#else
+  (void)worker;
+  (void)cpus;
+  logMessage(LogSeverity::Error, "ThreadPool::ThreadPool : Pinning workers isn't "
+             "supported on this platform, so continuing without pinning it.", "", id);
+#endif
+}
+
 ////////////////////////////////////////////////////////////////////////////////
-class ThreadPoolWorker {
-public:
-  explicit ThreadPoolWorker(ThreadPool& tp, size_t id);
-  void operator()();
+bool ThreadPool::popTask(size_t id, InlineTask& task) {
+  // Threads outside of the pool have an id past the last worker
+  const bool   stealing = (scheduling_ == SchedulingMode::WorkStealing);
+  const size_t node     = (id < localTasks_.size()) ? workerNode(id) : 0;
+  // Tasks in the shared queue that are more urgent than the default go first...
+  if (stealing && tasks_[node]->hasUrgent() && popShared(node, task)) {
+    --queued_;
+    return true;
+  }
+  if ((stealing || dequeueBatch_ > 1) && id < localTasks_.size()) {
+    // ... then the newest task from our own deque, as it's the most likely to
+    // be hot in the cache (or the next of a batch we took from the queue)...
+    WorkerQueue& local = *localTasks_[id];
+    {
+      std::lock_guard<std::mutex> guard(local.mt);
+      if (!local.tasks.empty()) {
+        task = local.tasks.pop_back();
+        --queued_;
+        return true;
+      }
+    }
+  }
+  // ... then our node's shared queue, and those of the other nodes ...
+  for (size_t i = 0; i < tasks_.size(); i++) {
+    if (popSharedBatch((node + i) % tasks_.size(), id, task)) {
+      --queued_;
+      return true;
+    }
+  }
+  // ... and finally the oldest task of another worker
+  return (stealing || dequeueBatch_ > 1) && stealTask(id, task);
+}
 
-private:
-  ThreadPool& tp_;
-  size_t      id_;
-};
+////////////////////////////////////////////////////////////////////////////////
+bool ThreadPool::stealTask(size_t id, InlineTask& task) {
+  // Steal from the workers of our own node first, and only then from the
+  // workers of other nodes
+  const size_t n       = localTasks_.size();
+  const size_t node    = (id < n) ? workerNode(id) : 0;
+  const int    nPasses = (tasks_.size() > 1) ? 2 : 1;
+  for (int pass = 0; pass < nPasses; pass++) {
+    for (size_t i = 1; i <= n; i++) {
+      const size_t victimId = (id + i) % n;
+      if (victimId == id || (nPasses > 1 && (workerNode(victimId) == node) != (pass == 0)))
+        continue;
+      WorkerQueue& victim = *localTasks_[victimId];
+      if (victim.state.load(std::memory_order_relaxed) == WorkerState::Stopped)
+        continue;  // An unused slot, so there's nothing to steal
+      std::lock_guard<std::mutex> guard(victim.mt);
+      if (!victim.tasks.empty()) {
+        task = victim.tasks.pop_front();
+        --queued_;
+#if HELPER_THREADPOOL_STATS
+        workerStats(id).steals.fetch_add(1, std::memory_order_relaxed);
+#endif
+        return true;
+      }
+    }
+  }
+  return false;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
-ThreadPool::ThreadPool(size_t nThreads, std::ostream* logStream)
-: log_(logStream) {
-  workers_.reserve(nThreads);
-  working_.reserve(nThreads);
-  for (unsigned int i = 0; i < nThreads; i++) {
-    working_.push_back(false);
-    workers_.push_back(std::thread(ThreadPoolWorker(*this, i)));
+bool ThreadPool::runPendingTask() {
+  const WorkerContext& context = currentWorker();
+  const size_t id = (context.pool == this) ? context.id : localTasks_.size();
+  InlineTask task;
+  if (!popTask(id, task))
+    return false;
+  runTask(task, id);
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::runTask(InlineTask& task, size_t id) {
+#if HELPER_THREADPOOL_STATS
+  const Clock::time_point start = Clock::now();
+#endif
+  try {
+    task();
+  } catch (const std::exception& e) {
+    // Eat the exception, but log it
+    logMessage(LogSeverity::Error, "Ignoring exception thrown by task: ", e.what(),
+               (id < localTasks_.size()) ? id : LogRecord::kNoWorker);
+  } catch (...) {
+    // Anything else must still be reported as done below, or the waiters
+    // would wait forever
+    logMessage(LogSeverity::Error, "Ignoring exception thrown by task: ", "unknown exception",
+               (id < localTasks_.size()) ? id : LogRecord::kNoWorker);
   }
+#if HELPER_THREADPOOL_STATS
+  recordTask(id, task.queuedAt, start, Clock::now());
+#endif
+  // Release anything the task captured before reporting it as done, so
+  // waiters can safely destroy whatever it referenced
+  task.reset();
+  taskDone();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-ThreadPool::~ThreadPool() {
-  waitUntilComplete(false, true, true);
+void ThreadPool::clearTasks() {
+  // Abandoned tasks are destroyed outside of the locks, as destroying a task
+  // may call back into the pool (e.g. to report a TaskGroup task as done)
+  size_t abandoned = 0;
+  for (auto& local : localTasks_) {
+    TaskDeque tasks;
+    {
+      std::lock_guard<std::mutex> guard(local->mt);
+      std::swap(tasks, local->tasks);
+      queued_ -= tasks.size();
+    }
+    abandoned += tasks.size();
+  }
+  InlineTask task;
+  for (size_t node = 0; node < tasks_.size(); node++) {
+    while (popShared(node, task)) {
+      --queued_;
+      task.reset();
+      abandoned++;
+    }
+  }
+  // Abandoned tasks will never run, so they're no longer in flight
+  taskDone(abandoned);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+size_t ThreadPool::queueDepth(size_t priority) const {
+  size_t depth = 0;
+  for (const auto& queue : tasks_)
+    depth += queue->depth(priority);
+  return depth;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::vector<size_t> ThreadPool::queueDepths() const {
+  std::vector<size_t> depths(tasks_.front()->priorityLevels());
+  for (size_t i = 0; i < depths.size(); i++)
+    depths[i] = queueDepth(i);
+  return depths;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+size_t ThreadPool::nodeCount() const {
+  return tasks_.size();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+size_t ThreadPool::workerNode(size_t worker) const {
+  return workerNodes_.empty() ? 0 : workerNodes_[worker % workerNodes_.size()];
+}
+
+////////////////////////////////////////////////////////////////////////////////
+std::optional<size_t> ThreadPool::workerIndex() const {
+  const WorkerContext& context = currentWorker();
+  if (context.pool != this)
+    return std::nullopt;
+  return context.id;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename Index, typename F>
+void ThreadPool::parallelFor(Index first, Index last, F function, size_t chunkSize) {
+  const size_t n = (last > first) ? static_cast<size_t>(last - first) : 0;
+  forEachChunk(n, chunkSize, [&](size_t begin, size_t end, size_t) {
+    for (size_t i = begin; i < end; i++) {
+      if constexpr (std::is_integral<Index>::value)
+        function(static_cast<Index>(first + i));
+      else
+        function(*(first + i));
+    }
+  });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename It, typename T, typename BinaryOp>
+T ThreadPool::parallelReduce(It first, It last, T init, BinaryOp op, size_t chunkSize) {
+  const size_t n = (last > first) ? static_cast<size_t>(last - first) : 0;
+  if (n == 0)
+    return init;
+  if (chunkSize == 0)
+    chunkSize = defaultChunkSize(n);
+
+  // Each chunk reduces into its own slot, and the slots are combined in order
+  // at the end, so the result doesn't depend on which threads ran what
+  std::vector<std::optional<T>> partials((n + chunkSize - 1) / chunkSize);
+  forEachChunk(n, chunkSize, [&](size_t begin, size_t end, size_t chunk) {
+    T partial = *(first + begin);
+    for (size_t i = begin + 1; i < end; i++)
+      partial = op(std::move(partial), *(first + i));
+    partials[chunk].emplace(std::move(partial));
+  });
+
+  for (auto& partial : partials)
+    init = op(std::move(init), std::move(*partial));
+  return init;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename InIt, typename OutIt, typename UnaryOp>
+OutIt ThreadPool::parallelTransform(InIt first, InIt last, OutIt dFirst, UnaryOp op,
+                                   size_t chunkSize) {
+  const size_t n = (last > first) ? static_cast<size_t>(last - first) : 0;
+  forEachChunk(n, chunkSize, [&](size_t begin, size_t end, size_t) {
+    for (size_t i = begin; i < end; i++)
+      *(dFirst + i) = op(*(first + i));
+  });
+  return dFirst + n;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename It, typename Compare>
+void ThreadPool::parallelSort(It first, It last, Compare comp, size_t chunkSize) {
+  const size_t n = (last > first) ? static_cast<size_t>(last - first) : 0;
+  if (chunkSize == 0)
+    chunkSize = std::max<size_t>(defaultChunkSize(n), 1024);
+  FirstException error;
+  {
+    TaskGroup group(*this);
+    sortRange(group, first, last, comp, chunkSize, error);
+    group.wait();
+  }
+  error.rethrow();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+size_t ThreadPool::defaultChunkSize(size_t n) const {
+  // Aim for a few chunks per thread (including the calling thread), so that
+  // uneven chunks can be balanced out
+  const size_t nChunks = 8 * (nWorkers_ + 1);
+  return std::max<size_t>(1, n / nChunks);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 template <typename F>
-void ThreadPool::addTask(F function) {
-  if (!allowNewTasks_) {
-    logMessage("ERROR in ThreadPool::addTask(F): "
-               "Attempting to add task to a stopped thread pool.");
+void ThreadPool::forEachChunk(size_t n, size_t chunkSize, F body) {
+  if (n == 0)
     return;
-  }
+  if (chunkSize == 0)
+    chunkSize = defaultChunkSize(n);
+  const size_t nChunks = (n + chunkSize - 1) / chunkSize;
+
+  FirstException error;
+  auto runChunk = [&](size_t chunk) {
+    if (error.caught())
+      return;  // Don't bother with the rest of the range
+    try {
+      const size_t begin = chunk * chunkSize;
+      body(begin, std::min(n, begin + chunkSize), chunk);
+    } catch (...) {
+      error.capture();
+    }
+  };
   {
-    std::lock_guard<std::mutex> guard(mt_);
-    if (!allowNewTasks_) {
-      logMessage("ERROR in ThreadPool::addTask(F): "
-                 "Attempting to add task to a stopped thread pool.");
-      return;
+    TaskGroup group(*this);
+    splitChunks(group, 0, nChunks, runChunk);
+    group.wait();
+  }
+  error.rethrow();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename F>
+void ThreadPool::splitChunks(TaskGroup& group, size_t first, size_t last, F& runChunk) {
+  // Hand the upper half of the range to the pool until we're left with a
+  // single chunk, which we run ourselves. Whoever picks up the upper half
+  // splits it again in the same way.
+  while (last - first > 1) {
+    const size_t mid = first + (last - first) / 2;
+    auto upper = [this, &group, &runChunk, mid, last]() {
+      splitChunks(group, mid, last, runChunk);
+    };
+    group.addTask(MustRunTask<decltype(upper)>(upper));
+    last = mid;
+  }
+  runChunk(first);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename It, typename Compare>
+void ThreadPool::sortRange(TaskGroup& group, It first, It last, Compare& comp,
+                           size_t chunkSize, FirstException& error) {
+  using Value = typename std::iterator_traits<It>::value_type;
+  try {
+    while (static_cast<size_t>(last - first) > chunkSize && !error.caught()) {
+      // Three-way partition around the median of the first, middle and last
+      // elements, so runs of equal elements don't unbalance the split. The
+      // median is swapped to the front and compared in place rather than
+      // copied, so move-only elements can be sorted.
+      It a = first, b = first + (last - first) / 2, c = last - 1;
+      It median = comp(*a, *b) ? (comp(*b, *c) ? b : (comp(*a, *c) ? c : a))
+                               : (comp(*a, *c) ? a : (comp(*b, *c) ? c : b));
+      std::iter_swap(first, median);
+      It pivot = std::partition(first + 1, last, [&](const Value& x) { return comp(x, *first); });
+      std::iter_swap(first, --pivot);
+      It lower = pivot;
+      It upper = std::partition(pivot + 1, last, [&](const Value& x) { return !comp(*pivot, x); });
+
+      // Hand the elements above the pivot to the pool and carry on with those
+      // below it
+      auto sortUpper = [this, &group, &comp, &error, upper, last, chunkSize]() {
+        sortRange(group, upper, last, comp, chunkSize, error);
+      };
+      group.addTask(MustRunTask<decltype(sortUpper)>(sortUpper));
+      last = lower;
     }
-    tasks_.push(std::function<void()>(function));
+    if (!error.caught())
+      std::sort(first, last, comp);
+  } catch (...) {
+    error.capture();
   }
-  cv_.notify_one();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-// template <typename F>
-// void ThreadPool::addTask(F function)
-// // Declared in the header file to allow for template matching
+ThreadPoolStats ThreadPool::stats() const {
+  ThreadPoolStats snapshot;
+#if HELPER_THREADPOOL_STATS
+  for (const auto& worker : stats_) {
+    ThreadPoolStats::Worker counters;
+    counters.tasksRun       = worker->tasksRun.load(std::memory_order_relaxed);
+    counters.steals         = worker->steals.load(std::memory_order_relaxed);
+    counters.busyTime       = worker->busyTime.load(std::memory_order_relaxed);
+    counters.idleTime       = worker->idleTime.load(std::memory_order_relaxed);
+    counters.queueHighWater = worker->queueHighWater.load(std::memory_order_relaxed);
+    snapshot.workers.push_back(counters);
+
+    snapshot.total.tasksRun      += counters.tasksRun;
+    snapshot.total.steals        += counters.steals;
+    snapshot.total.busyTime      += counters.busyTime;
+    snapshot.total.idleTime      += counters.idleTime;
+    snapshot.total.queueHighWater = std::max(snapshot.total.queueHighWater,
+                                             counters.queueHighWater);
+    worker->queueWait.addTo(snapshot.queueWait);
+    worker->runTime.addTo(snapshot.runTime);
+  }
+#endif
+  return snapshot;
+}
 
 ////////////////////////////////////////////////////////////////////////////////
-void ThreadPool::waitUntilComplete(bool allowNewTasks,
-                                   bool abandonTasks,
-                                   bool terminatePool) {
-  if (allowNewTasks && (abandonTasks || terminatePool))
-    throw std::logic_error("ThreadPool::waitUntilComplete : "
-                           "allowNewTasks is incompatible with abandonTasks "
-                           "and terminatePool.");
+void ThreadPool::writeTrace(std::ostream& out) const {
+  out << "{\"traceEvents\":[";
+#if HELPER_THREADPOOL_STATS
+  bool first = true;
+  for (size_t id = 0; id < stats_.size(); id++) {
+    const std::string name = (id + 1 < stats_.size())
+                           ? "ThreadPoolWorker[" + std::to_string(id) + "]"
+                           : "Other threads";
+    out << (first ? "\n" : ",\n")
+        << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << id
+        << ",\"args\":{\"name\":\"" << name << "\"}}";
+    first = false;
+    const WorkerStats& worker = *stats_[id];
+    if (!worker.trace)
+      continue;
+    // The ring holds the last traceCapacity_ events
+    const size_t end   = worker.nextEvent.load(std::memory_order_relaxed);
+    const size_t begin = (end > traceCapacity_) ? end - traceCapacity_ : 0;
+    for (size_t i = begin; i < end; i++) {
+      const TraceEvent& event = worker.trace[i % traceCapacity_];
+      out << ",\n{\"name\":\"task\",\"cat\":\"ThreadPool\",\"ph\":\"X\",\"pid\":0,\"tid\":" << id
+          << ",\"ts\":" << event.start.load(std::memory_order_relaxed) / 1000.0
+          << ",\"dur\":" << event.run.load(std::memory_order_relaxed) / 1000.0
+          << ",\"args\":{\"wait_us\":" << event.wait.load(std::memory_order_relaxed) / 1000.0
+          << "}}";
+    }
+  }
+#endif
+  out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+}
 
-  allowNewTasks_ = allowNewTasks;
+#if HELPER_THREADPOOL_STATS
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::AtomicHistogram::record(uint64_t value) {
+  counts[LatencyHistogram::bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+  sum.fetch_add(value, std::memory_order_relaxed);
+  uint64_t previous = max.load(std::memory_order_relaxed);
+  while (value > previous && !max.compare_exchange_weak(previous, value,
+                                                        std::memory_order_relaxed)) {}
+}
 
-  if (abandonTasks) {
-    // We're abandoning tasks (and not allowing new ones), so ditch the task queue
-    std::lock_guard<std::mutex> guard(mt_);
-    while (!tasks_.empty())
-      tasks_.pop();
-  } else {
-    // Wait until all tasks have been completed
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::AtomicHistogram::addTo(LatencyHistogram& histogram) const {
+  for (size_t i = 0; i < LatencyHistogram::kBuckets; i++) {
+    const uint64_t count = counts[i].load(std::memory_order_relaxed);
+    histogram.counts_[i] += count;
+    histogram.count_     += count;
+  }
+  histogram.sum_ += sum.load(std::memory_order_relaxed);
+  histogram.max_  = std::max(histogram.max_, max.load(std::memory_order_relaxed));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::recordQueued(size_t depth) {
+  const WorkerContext& context = currentWorker();
+  WorkerStats& worker = workerStats((context.pool == this) ? context.id : localTasks_.size());
+  size_t previous = worker.queueHighWater.load(std::memory_order_relaxed);
+  while (depth > previous && !worker.queueHighWater.compare_exchange_weak(
+                                 previous, depth, std::memory_order_relaxed)) {}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::recordTask(size_t id, Clock::time_point queuedAt, Clock::time_point start,
+                            Clock::time_point end) {
+  using std::chrono::duration_cast;
+  using std::chrono::nanoseconds;
+  const uint64_t wait = std::max<int64_t>(0, duration_cast<nanoseconds>(start - queuedAt).count());
+  const uint64_t run  = duration_cast<nanoseconds>(end - start).count();
+
+  WorkerStats& worker = workerStats(id);
+  worker.tasksRun.fetch_add(1, std::memory_order_relaxed);
+  worker.busyTime.fetch_add(run, std::memory_order_relaxed);
+  worker.queueWait.record(wait);
+  worker.runTime.record(run);
+  if (worker.trace) {
+    TraceEvent& event = worker.trace[worker.nextEvent.fetch_add(1, std::memory_order_relaxed)
+                                     % traceCapacity_];
+    event.start.store(duration_cast<nanoseconds>(start - epoch_).count(),
+                      std::memory_order_relaxed);
+    event.wait.store(wait, std::memory_order_relaxed);
+    event.run.store(run, std::memory_order_relaxed);
+  }
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::logMessage(LogSeverity severity, const char* message, const char* detail,
+                            size_t worker) {
+  if (log_ == nullptr)
+    return;
+  LogRecord record;
+  record.severity = severity;
+  record.worker   = worker;
+  record.time     = Clock::now();
+  record.message  = message;
+  std::strncpy(record.detail, detail, LogRecord::kDetailSize - 1);
+
+  // Each worker has its own buffer, so they never contend with each other
+  const WorkerContext& context = currentWorker();
+  const size_t id = (context.pool == this) ? context.id : localTasks_.size();
+  if (id >= logs_.size() || !logs_[id] || !logs_[id]->tryPush(record)) {
+    droppedLogs_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  // Only the first record since the log was last written wakes the writer.
+  // Taking logWakeMt_ (which is never held for long) ensures the writer is
+  // either about to see logPending_ or already waiting for the notification.
+  if (!logPending_.exchange(true)) {
+    { std::lock_guard<std::mutex> guard(logWakeMt_); }
+    logCv_.notify_one();
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+uint64_t ThreadPool::droppedLogMessages() const {
+  return droppedLogs_.load(std::memory_order_relaxed);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::flushLog() {
+  if (log_ == nullptr)
+    return;
+  std::lock_guard<std::mutex> guard(logMt_);
+  writeLog();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::startLogThread() {
+  logThread_ = std::thread([this]() {
     while (1) {
       {
-        std::lock_guard<std::mutex> guard(mt_);
-        if (tasks_.empty()) {
-          // At this point the task queue is empty, but tasks may still be running
-          allowNewTasks_ = false;
-          break;
-        }
+        std::unique_lock<std::mutex> lock(logWakeMt_);
+        logCv_.wait(lock, [this]() { return stopLog_ || logPending_.load(); });
+        if (stopLog_)
+          return;
       }
-      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      std::lock_guard<std::mutex> guard(logMt_);
+      writeLog();
     }
+  });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::stopLogThread() {
+  if (!logThread_.joinable())
+    return;
+  {
+    std::lock_guard<std::mutex> guard(logWakeMt_);
+    stopLog_ = true;
   }
-  if (terminatePool) {
-    // There are no more tasks on the queue, so notify each thread and join
-    terminate_ = true;
-    cv_.notify_all();
-    for (auto& w : workers_) {
-      if (w.joinable())
-        w.join();
-    }
-  } else {
-    // Wait for each running process to terminate
-    while (std::any_of(working_.cbegin(), working_.cend(), [](const char&b) { return b; })) {
-      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  logCv_.notify_all();
+  logThread_.join();
+  flushLog();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::writeLog() {
+  // Called with logMt_ held, so this is the only thread writing to log_
+  static const char* const kSeverities[] = { "INFO", "WARNING", "ERROR" };
+  logPending_ = false;
+  std::ostream& out = *log_;
+  bool written = false;
+  LogRecord record;
+  for (auto& buffer : logs_) {
+    while (buffer && buffer->tryPop(record)) {
+      written = true;
+      const double seconds = std::chrono::duration<double>(record.time - created_).count();
+      out << kSeverities[static_cast<int>(record.severity)] << " in ";
+      if (record.worker == LogRecord::kNoWorker)
+        out << "ThreadPool";
+      else
+        out << "ThreadPoolWorker[" << record.worker << "]";
+      out << " at +" << seconds << "s : " << record.message << record.detail << "\n";
     }
-    // We're done, so allow new tasks again
-    allowNewTasks_ = true;
   }
+  const uint64_t dropped = droppedLogs_.load(std::memory_order_relaxed);
+  if (dropped != reportedDrops_) {
+    out << "WARNING in ThreadPool : " << (dropped - reportedDrops_)
+        << " log messages were dropped, as the log buffers were full.\n";
+    reportedDrops_ = dropped;
+    written = true;
+  }
+  if (written)
+    out.flush();
 }
 
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPool::cpuRelax() {
+  // Tell the CPU we're in a spin loop, so it can save power and give the
+  // core's other hardware thread a look in
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(_M_X64) || defined(_M_IX86)
+  _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  __asm__ __volatile__("yield");
+#endif
+}
 
 ////////////////////////////////////////////////////////////////////////////////
-void ThreadPool::logMessage(const std::string& msg) {
-  if (log_ == nullptr)
-    return;
-  (*log_) << msg.c_str();
+ThreadPool::WorkerContext& ThreadPool::currentWorker() {
+  static thread_local WorkerContext context;
+  return context;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 ThreadPoolWorker::ThreadPoolWorker(ThreadPool& tp, size_t id)
 : tp_(tp),
-  id_(id) {
+  id_(id),
+  spinBudget_(tp.spinCount_) {
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 void ThreadPoolWorker::operator()() {
+  ThreadPool::currentWorker().pool = &tp_;
+  ThreadPool::currentWorker().id   = id_;
+  ThreadPool::WorkerQueue& slot = *tp_.localTasks_[id_];
+
   while (1) {
-    std::function<void()> currentTask;
+    // If ThreadPool::resize has retired us, hand back our tasks and exit
+    if (slot.state == ThreadPool::WorkerState::Retiring && tp_.retireWorker(id_))
+      return;
 
-    { // START scope for unique_lock
+    InlineTask currentTask;
+
+    if (!tp_.popTask(id_, currentTask)) {
+#if HELPER_THREADPOOL_STATS
+      // Time spent spinning counts as idle, as well as time spent parked
+      const ThreadPool::Clock::time_point idleStart = ThreadPool::Clock::now();
+#endif
+      if (spinForTask()) {
+#if HELPER_THREADPOOL_STATS
+        recordIdle(idleStart);
+#endif
+        continue;
+      }
+      // START scope for unique_lock
       std::unique_lock<std::mutex> lock(tp_.mt_);
-      // Wait while the thread pool is accepting tasks but there are none
-      if (tp_.tasks_.empty()) {
-        tp_.working_[id_] = false;
-        tp_.cv_.wait(lock);
+      // Wait while the thread pool is accepting tasks but there are none. We
+      // register as idle before re-checking queued_, so a producer either sees
+      // us as idle and notifies, or we see its task and don't wait.
+      ++tp_.idle_;
+      bool timedOut = false;
+      if (tp_.queued_ == 0 && !tp_.terminate_ && slot.state == ThreadPool::WorkerState::Running) {
+        if (tp_.autoscale_)
+          timedOut = (tp_.cv_.wait_for(lock, tp_.keepAlive_) == std::cv_status::timeout);
+        else
+          tp_.cv_.wait(lock);
       }
+#if HELPER_THREADPOOL_STATS
+      recordIdle(idleStart);
+#endif
+      --tp_.idle_;
       // If we're not allowing new tasks and there are none left, exit
-      if (tp_.terminate_ && tp_.tasks_.empty()) {
+      if (tp_.terminate_ && tp_.queued_ == 0) {
         // End the function so the thread can terminate
         return;
       }
-      currentTask = tp_.tasks_.front();
-      tp_.tasks_.pop();
+      lock.unlock();
+      // If we've been idle for the whole keep-alive period the pool may not
+      // need us any more
+      if (timedOut && tp_.queued_ == 0 && tp_.retireIdleWorker(id_))
+        return;
+      continue;
     } // END scope of unique_lock
-    
-    try {
-      tp_.working_[id_] = true;
-      currentTask();
-    } catch (const std::exception& e) {
-      // Eat the exception, but log with the parent ThreadPool
-      tp_.logMessage("ERROR in ThreadPoolWorker[" + std::to_string(id_) + "] "
-                     + "task. Original message is as follows:\n\t"
-                     + std::string(e.what()) + "\n"
-                     + "Ignoring exception and continuing.\n");
-    }
+
+    tp_.runTask(currentTask, id_);
+    slot.tasksRun.store(slot.tasksRun.load(std::memory_order_relaxed) + 1,
+                        std::memory_order_relaxed);
+  }
+}
+
+#if HELPER_THREADPOOL_STATS
+////////////////////////////////////////////////////////////////////////////////
+void ThreadPoolWorker::recordIdle(ThreadPool::Clock::time_point start) {
+  tp_.workerStats(id_).idleTime.fetch_add(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(ThreadPool::Clock::now() - start).count(),
+      std::memory_order_relaxed);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+bool ThreadPoolWorker::spinForTask() {
+  if (tp_.idlePolicy_ == IdlePolicy::Park)
+    return false;
+  // While we're counted as spinning, producers leave it to us to notice their
+  // tasks rather than waking a parked worker
+  ++tp_.spinning_;
+  const size_t nPolls = spinBudget_ + tp_.yieldCount_;
+  bool found = false;
+  for (size_t i = 0; i < nPolls && !found; i++) {
+    if (i < spinBudget_)
+      ThreadPool::cpuRelax();
+    else
+      std::this_thread::yield();
+    found = (tp_.queued_ > 0);
+  }
+  --tp_.spinning_;
+
+  if (tp_.idlePolicy_ == IdlePolicy::Adaptive) {
+    const size_t minBudget = std::max<size_t>(1, tp_.spinCount_ / 64);
+    spinBudget_ = found ? std::min(tp_.spinCount_, spinBudget_ * 2)
+                        : std::max(minBudget, spinBudget_ / 2);
   }
+  // There may be more tasks than we can take, and their producers may have
+  // counted on us, so hand on to a parked worker
+  if (found && tp_.queued_ > 1)
+    tp_.wakeWorker();
+  return found;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TaskGroup::TaskGroup(ThreadPool& pool)
+: pool_(pool) {
+}
+
+////////////////////////////////////////////////////////////////////////////////
+TaskGroup::~TaskGroup() {
+  wait();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+template <typename F>
+bool TaskGroup::addTask(F function) {
+  ++pending_;
+  // The token is destroyed with the task, so it's counted as done whether it
+  // runs, throws, is abandoned or is rejected by the pool
+  return pool_.pushTask(InlineTask(GroupTask<F>{ DoneToken(this), std::move(function) }));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void TaskGroup::wait() {
+  // Rather than just blocking, help the pool work through its queue. Once
+  // nothing is left to pick up our tasks are all running on other threads.
+  while (pending_ != 0 && pool_.runPendingTask()) {}
+  std::unique_lock<std::mutex> lock(mt_);
+  cv_.wait(lock, [this]() { return pending_ == 0; });
+}
+
+////////////////////////////////////////////////////////////////////////////////
+void TaskGroup::taskDone() {
+  // Decrement under the lock, otherwise wait() could see pending_ == 0 and the
+  // group be destroyed before we get to notify
+  std::lock_guard<std::mutex> guard(mt_);
+  if (--pending_ == 0)
+    cv_.notify_all();
 }
 
 }  // namespace helper